@@ -2,12 +2,158 @@
 
 #include "act-iter.h"
 
+#include "coord.h"
 #include "env.h"
 #include "losglobal.h"
 
+// Monsters indexed by the block of the map they stand in, so that the near
+// iterators only look at monsters that could be within LOS range of their
+// centre rather than at every slot in menv. Each block has a mask of the
+// menv slots in it, which keeps the iterators in menv order.
+#define MON_BLOCK_SIZE 8
+static const int MON_BLOCKS_Y = (GYM + MON_BLOCK_SIZE - 1) / MON_BLOCK_SIZE;
+static const int MON_BLOCKS = (GXM + MON_BLOCK_SIZE - 1) / MON_BLOCK_SIZE
+                              * MON_BLOCKS_Y;
+static const int MON_MASK_WORDS = sizeof(monster_mask) / sizeof(uint64_t);
+
+static monster_mask mon_blocks[MON_BLOCKS];
+// Every menv slot holding a monster, and maybe a few that were handed out by
+// get_free_monster() but never filled in. monster_iterator walks only these.
+static monster_mask used_slots;
+// The block each slot is filed under, plus one; zero if it is in none.
+static int mon_block_of[MAX_MONSTERS];
+
+static int _mon_block(const coord_def &p)
+{
+    if (!map_bounds(p))
+        return 0;
+    return p.x / MON_BLOCK_SIZE * MON_BLOCKS_Y + p.y / MON_BLOCK_SIZE + 1;
+}
+
+static int _mon_slot(const monster &mon)
+{
+    const monster *first = &menv[0];
+    if (&mon < first || &mon >= first + MAX_MONSTERS)
+        return -1; // a temporary copy, or one of the blame placeholders
+    return &mon - first;
+}
+
+// Update the index after mon's position has been changed. Every assignment
+// to a monster's position has to be followed by this.
+void monster_index_moved(const monster &mon)
+{
+    const int i = _mon_slot(mon);
+    if (i == -1)
+        return;
+
+    const int block = _mon_block(mon.pos());
+    if (block == mon_block_of[i])
+        return;
+
+    const uint64_t bit = uint64_t(1) << (i % 64);
+    if (mon_block_of[i])
+        mon_blocks[mon_block_of[i] - 1][i / 64] &= ~bit;
+    if (block)
+        mon_blocks[block - 1][i / 64] |= bit;
+    mon_block_of[i] = block;
+}
+
+void monster_slot_taken(const monster &mon)
+{
+    const int i = _mon_slot(mon);
+    if (i != -1)
+        used_slots[i / 64] |= uint64_t(1) << (i % 64);
+}
+
+void monster_slot_freed(const monster &mon)
+{
+    const int i = _mon_slot(mon);
+    if (i != -1)
+        used_slots[i / 64] &= ~(uint64_t(1) << (i % 64));
+}
+
+// The lowest empty menv slot, or NON_MONSTER if there is none. Only slots
+// marked as used need a look at the monster itself.
+int free_monster_slot()
+{
+    for (int i = 0; i < MAX_MONSTERS; ++i)
+    {
+        const uint64_t bit = uint64_t(1) << (i % 64);
+        if (!(used_slots[i / 64] & bit))
+            return i;
+        if (menv[i].type == MONS_NO_MONSTER)
+        {
+            // Taken but never filled in.
+            used_slots[i / 64] &= ~bit;
+            return i;
+        }
+    }
+    return NON_MONSTER;
+}
+
+// Is mon filed where it stands, and as used? For debug_mons_scan().
+bool monster_index_ok(const monster &mon)
+{
+    const int i = _mon_slot(mon);
+    if (i == -1)
+        return true;
+
+    const uint64_t bit = uint64_t(1) << (i % 64);
+    const int block = _mon_block(mon.pos());
+    return mon_block_of[i] == block
+           && (!block || mon_blocks[block - 1][i / 64] & bit)
+           && (mon.type == MONS_NO_MONSTER || used_slots[i / 64] & bit);
+}
+
+// Find the blocks holding monsters that might be seen from c.
+static void _monsters_near(const coord_def &c, los_type los,
+                           monster_block_range &range)
+{
+    // LOS_NONE sees everything, however far.
+    range.all = los == LOS_NONE;
+    range.x1 = max(c.x - LOS_RADIUS, 0) / MON_BLOCK_SIZE;
+    range.x2 = min(c.x + LOS_RADIUS, GXM - 1) / MON_BLOCK_SIZE;
+    range.y1 = max(c.y - LOS_RADIUS, 0) / MON_BLOCK_SIZE;
+    range.y2 = min(c.y + LOS_RADIUS, GYM - 1) / MON_BLOCK_SIZE;
+}
+
+// Word w of the mask of slots currently filed in range.
+static uint64_t _range_word(const monster_block_range &range, int w)
+{
+    if (range.all)
+        return used_slots[w];
+
+    uint64_t bits = 0;
+    for (int x = range.x1; x <= range.x2; ++x)
+        for (int y = range.y1; y <= range.y2; ++y)
+            bits |= mon_blocks[x * MON_BLOCKS_Y + y][w];
+    return bits;
+}
+
+// The first slot after i filed in range, or MAX_MONSTERS if there is none.
+static int _next_monster(const monster_block_range &range, int i)
+{
+    ++i;
+    for (int w = i / 64; w < MON_MASK_WORDS; ++w)
+    {
+        uint64_t bits = _range_word(range, w);
+        if (w == i / 64)
+            bits &= ~uint64_t(0) << (i % 64);
+        if (!bits)
+            continue;
+
+        int bit = 0;
+        while (!(bits >> bit & 1))
+            ++bit;
+        return min(w * 64 + bit, (int)MAX_MONSTERS);
+    }
+    return MAX_MONSTERS;
+}
+
 actor_near_iterator::actor_near_iterator(coord_def c, los_type los)
     : center(c), _los(los), viewer(nullptr), i(-1)
 {
+    _monsters_near(center, _los, candidates);
     if (!valid(&you))
         advance();
 }
@@ -15,6 +161,7 @@ actor_near_iterator::actor_near_iterator(coord_def c, los_type los)
 actor_near_iterator::actor_near_iterator(const actor* a, los_type los)
     : center(a->pos()), _los(los), viewer(a), i(-1)
 {
+    _monsters_near(center, _los, candidates);
     if (!valid(&you))
         advance();
 }
@@ -64,7 +211,7 @@ bool actor_near_iterator::valid(const actor* a) const
 void actor_near_iterator::advance()
 {
     do
-         if (++i >= MAX_MONSTERS)
+         if ((i = _next_monster(candidates, i)) >= MAX_MONSTERS)
              return;
     while (!valid(**this));
 }
@@ -74,6 +221,7 @@ void actor_near_iterator::advance()
 monster_near_iterator::monster_near_iterator(coord_def c, los_type los)
     : center(c), _los(los), viewer(nullptr), i(0)
 {
+    _monsters_near(center, _los, candidates);
     if (!valid(&menv[0]))
         advance();
     begin_point = i;
@@ -82,6 +230,7 @@ monster_near_iterator::monster_near_iterator(coord_def c, los_type los)
 monster_near_iterator::monster_near_iterator(const actor *a, los_type los)
     : center(a->pos()), _los(los), viewer(a), i(0)
 {
+    _monsters_near(center, _los, candidates);
     if (!valid(&menv[0]))
         advance();
     begin_point = i;
@@ -154,7 +303,7 @@ bool monster_near_iterator::valid(const monster* a) const
 void monster_near_iterator::advance()
 {
     do
-         if (++i >= MAX_MONSTERS)
+         if ((i = _next_monster(candidates, i)) >= MAX_MONSTERS)
              return;
     while (!valid(**this));
 }
@@ -162,10 +311,9 @@ void monster_near_iterator::advance()
 //////////////////////////////////////////////////////////////////////////
 
 monster_iterator::monster_iterator()
-    : i(0)
+    : i(-1)
 {
-    while (i < MAX_MONSTERS && !menv[i].alive())
-        i++;
+    advance();
 }
 
 monster_iterator::operator bool() const
@@ -188,9 +336,7 @@ monster* monster_iterator::operator->() const
 
 monster_iterator& monster_iterator::operator++()
 {
-    while (++i < MAX_MONSTERS)
-        if (menv[i].alive())
-            break;
+    advance();
     return *this;
 }
 
@@ -203,8 +349,9 @@ monster_iterator monster_iterator::operator++(int)
 
 void monster_iterator::advance()
 {
+    static const monster_block_range every_slot = { true, 0, 0, 0, 0 };
     do
-         if (++i >= MAX_MONSTERS)
+         if ((i = _next_monster(every_slot, i)) >= MAX_MONSTERS)
              return;
     while (!(*this)->alive());
 }
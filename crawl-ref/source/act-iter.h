@@ -7,6 +7,25 @@
 
 #include "los-type.h"
 
+// A set of slots in menv, one bit each.
+typedef uint64_t monster_mask[(MAX_MONSTERS + 63) / 64];
+
+// The map blocks a near iterator takes its candidates from. The blocks'
+// masks are read as the iterator advances, so monsters that move into range
+// or are created during the loop are still visited, as with a plain walk
+// over menv.
+struct monster_block_range
+{
+    bool all;           // every used slot, however far (LOS_NONE)
+    int x1, x2, y1, y2; // otherwise, these blocks
+};
+
+void monster_index_moved(const monster &mon);
+void monster_slot_taken(const monster &mon);
+void monster_slot_freed(const monster &mon);
+int free_monster_slot();
+bool monster_index_ok(const monster &mon);
+
 class actor_near_iterator
 {
 public:
@@ -24,6 +43,7 @@ protected:
     los_type _los;
     const actor* viewer;
     int i;
+    monster_block_range candidates;
 
     bool valid(const actor* a) const;
     void advance();
@@ -51,6 +71,7 @@ protected:
     const actor* viewer;
     int i;
     int begin_point;
+    monster_block_range candidates;
 
     bool valid(const monster* a) const;
     void advance();
@@ -138,6 +138,8 @@ void actor::set_position(const coord_def &c)
 {
     const coord_def oldpos = position;
     position = c;
+    if (is_monster())
+        monster_index_moved(*as_monster());
     los_actor_moved(this, oldpos);
     areas_actor_moved(this, oldpos);
 }
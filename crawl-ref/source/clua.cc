@@ -10,12 +10,15 @@
 #include "files.h"
 #include "libutil.h"
 #include "l-libs.h"
+#include "maps.h"
 #include "maybe-bool.h"
 #include "misc.h" // erase_val
 #include "options.h"
+#include "startup.h"
 #include "state.h"
 #include "stringutil.h"
 #include "syscalls.h"
+#include "tags.h"
 #include "unicode.h"
 #include "version.h"
 
@@ -288,6 +291,90 @@ bool CLua::is_path_safe(string s, bool trusted)
            && (trusted || s.find("dlua") != 0);
 }
 
+// The scripts under dat/dlua and dat/clua are kept compiled next to the des
+// cache, so that later processes can skip parsing them. The cache records
+// the source path and is checked against its modification time.
+static bool _lua_cacheable(const string &filename, bool trusted)
+{
+    return trusted && (starts_with(filename, "dlua/")
+                       || starts_with(filename, "clua/"));
+}
+
+static string _lua_cache_path(string filename)
+{
+    replace(filename.begin(), filename.end(), '/', '_');
+    return get_descache_path(filename, ".luac");
+}
+
+static bool _load_cached_lua(lua_State *ls, const string &filename,
+                             const string &file, time_t mtime)
+{
+    mapped_file cache(_lua_cache_path(filename));
+    if (!cache.valid())
+        return false;
+
+    reader inf(cache.data(), cache.size(), TAG_MINOR_VERSION);
+    inf.set_safe_read(true);
+    if (!verify_descache_header(inf, mtime))
+        return false;
+
+    dlua_chunk chunk;
+    try
+    {
+        if (unmarshallString(inf) != file)
+            return false;
+        chunk.read(inf);
+    }
+    catch (short_read_exception &E)
+    {
+        return false;
+    }
+
+    const string &compiled = chunk.compiled_chunk();
+    if (compiled.empty())
+        return false;
+
+    if (luaL_loadbuffer(ls, compiled.data(), compiled.size(),
+                        ("@" + file).c_str()))
+    {
+        // Probably built by a different Lua; recompile from source.
+        lua_pop(ls, 1);
+        return false;
+    }
+    return true;
+}
+
+// Writes the function on top of the stack, leaving it there.
+static void _save_cached_lua(lua_State *ls, const string &filename,
+                             const string &file, time_t mtime)
+{
+    const dlua_chunk chunk(ls);
+    if (!chunk.error.empty())
+        return;
+
+    // Write to a temporary and rename it into place, so that other
+    // processes never see a partial file. The lock keeps two processes
+    // caching the same file from writing the temporary at once.
+    const string cachefile = _lua_cache_path(filename);
+    FILE *lock = lk_open("wb", cachefile + ".lk");
+    if (!lock)
+        return;
+
+    const string tmpfile = cachefile + ".tmp";
+    if (FILE *fp = fopen_replace(tmpfile.c_str()))
+    {
+        writer outf(tmpfile, fp, true);
+        write_descache_header(outf, mtime);
+        marshallString(outf, file);
+        chunk.write(outf);
+        if (fclose(fp) == 0 && outf.succeeded())
+            rename_u(tmpfile.c_str(), cachefile.c_str());
+        else
+            unlink_u(tmpfile.c_str());
+    }
+    lk_close(lock);
+}
+
 int CLua::loadfile(lua_State *ls, const char *filename, bool trusted,
                    bool die_on_fail)
 {
@@ -310,6 +397,11 @@ int CLua::loadfile(lua_State *ls, const char *filename, bool trusted,
         return -1;
     }
 
+    const bool cacheable = _lua_cacheable(filename, trusted);
+    const time_t mtime = cacheable ? file_modtime(file) : 0;
+    if (cacheable && _load_cached_lua(ls, filename, file, mtime))
+        return 0;
+
     FileLineInput f(file.c_str());
     string script;
     while (!f.eof())
@@ -319,8 +411,11 @@ int CLua::loadfile(lua_State *ls, const char *filename, bool trusted,
         abort();
 
     // prefixing with @ stops lua from adding [string "%s"]
-    return luaL_loadbuffer(ls, &script[0], script.length(),
-                           ("@" + file).c_str());
+    const int err = luaL_loadbuffer(ls, &script[0], script.length(),
+                                    ("@" + file).c_str());
+    if (!err && cacheable)
+        _save_cached_lua(ls, filename, file, mtime);
+    return err;
 }
 
 int CLua::execfile(const char *filename, bool trusted, bool die_on_fail,
@@ -753,6 +848,8 @@ void CLua::init_lua()
     if (_state)
         return;
 
+    startup_phase phase(managed_vm ? "user Lua" : "dungeon Lua interpreter");
+
 #ifdef NO_CUSTOM_ALLOCATOR
     // If this is likely to be used as a server, warn the builder.
     // NOTE: #warning doesn't work on MSVC, so this will be fatal there
@@ -11,6 +11,7 @@
 #include <cmath>
 #include <sstream>
 
+#include "act-iter.h"
 #include "artefact.h"
 #include "branch.h"
 #include "butcher.h"
@@ -381,6 +382,14 @@ void debug_mons_scan()
             }
         } // if (mgrd(m->pos()) != i)
 
+        if (!monster_index_ok(*m))
+        {
+            mprf(MSGCH_ERROR, "Monster %s at (%d, %d) is misfiled in the "
+                              "monster index, midx = %d",
+                 m->full_name(DESC_PLAIN).c_str(),
+                 pos.x, pos.y, i);
+        }
+
         if (feat_is_wall(grd(pos)))
         {
 #if defined(DEBUG_FATAL)
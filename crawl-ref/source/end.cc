@@ -201,6 +201,9 @@ NORETURN void end(int exit_code, bool print_error, const char *format, ...)
 #ifdef DEBUG_PROPS
         dump_prop_accesses();
 #endif
+#ifdef USE_TILE_WEB
+        tiles.print_replay_stats();
+#endif
 
         if (!error.empty())
         {
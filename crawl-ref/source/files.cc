@@ -22,6 +22,7 @@
 #endif
 #include <sys/types.h>
 #ifdef UNIX
+#include <sys/mman.h>
 #include <unistd.h>
 #endif
 
@@ -55,6 +56,7 @@
 #include "kills.h"
 #include "level-state-type.h"
 #include "libutil.h"
+#include "losglobal.h"
 #include "macro.h"
 #include "mapmark.h"
 #include "message.h"
@@ -122,6 +124,8 @@ static bool _ghost_version_compatible(const save_version &version);
 
 static bool _restore_tagged_chunk(package *save, const string &name,
                                   tag_type tag, const char* complaint);
+static void _restore_level(const string &level_name);
+static void _forget_stored_level();
 static bool _read_char_chunk(package *save);
 
 static bool _convert_obsolete_species();
@@ -1498,8 +1502,7 @@ bool generate_level(const level_id &l)
         // if portals were generated, we're currently elsewhere.
         ASSERT(you.save->has_chunk(save_name));
         dprf("Reloading new level '%s'.", save_name.c_str());
-        _restore_tagged_chunk(you.save, save_name, TAG_LEVEL,
-            "Level file is invalid.");
+        _restore_level(save_name);
     }
     return true;
 }
@@ -1696,6 +1699,10 @@ bool load_level(dungeon_feature_type stair_taken, load_mode_type load_mode,
     if (feat_is_escape_hatch(stair_taken))
         hatch_name = _get_hatch_name();
 
+    // Keep the LOS worked out here for when the player comes back.
+    if (load_mode == LOAD_ENTER_LEVEL && old_level.is_valid())
+        stash_los(old_level);
+
     if (load_mode != LOAD_VISITOR)
         popped = _leave_level(stair_taken, old_level, &return_pos);
 
@@ -1764,7 +1771,7 @@ bool load_level(dungeon_feature_type stair_taken, load_mode_type load_mode,
     {
         ASSERT(you.save->has_chunk(level_name));
         dprf("Loading old level '%s'.", level_name.c_str());
-        _restore_tagged_chunk(you.save, level_name, TAG_LEVEL, "Level file is invalid.");
+        _restore_level(level_name);
         _redraw_all(); // TODO why is there a redraw call here?
     }
 
@@ -1777,6 +1784,7 @@ bool load_level(dungeon_feature_type stair_taken, load_mode_type load_mode,
     deleteAll(env.final_effects);
 
     los_changed();
+    restore_stashed_los(level_id::current());
 
     if (load_mode != LOAD_VISITOR)
         you.set_level_visited(level_id::current());
@@ -2007,6 +2015,34 @@ bool load_level(dungeon_feature_type stair_taken, load_mode_type load_mode,
     return just_created_level;
 }
 
+// A level is kept as one chunk per level_section: the level's own chunk holds
+// the version and the header section, and every other section goes in a chunk
+// named after the level. A section that is already stored with the same data
+// isn't written again, so a level that was only passed through costs little
+// more than its header and monsters.
+static const char *_level_section_suffixes[NUM_LEVEL_SECTIONS] =
+{
+    "", ".map", ".env", ".itm", ".mon", ".til",
+};
+
+static string _level_section_chunk(const string &level_name, int section)
+{
+    return level_name + _level_section_suffixes[section];
+}
+
+// The sections of the level last loaded or saved, exactly as they are in the
+// save. Every read or write of a level's sections replaces these, and nothing
+// else touches those chunks, so a section that is in the save and matches the
+// copy here is known to be up to date.
+static string _stored_level;
+static vector<vector<unsigned char>> _stored_sections;
+
+static void _forget_stored_level()
+{
+    _stored_level.clear();
+    _stored_sections.clear();
+}
+
 static void _save_level(const level_id& lid)
 {
     if (you.level_visited(lid))
@@ -2015,7 +2051,33 @@ static void _save_level(const level_id& lid)
     // Nail all items to the ground.
     fix_item_coordinates();
 
-    _write_tagged_chunk(lid.describe(), TAG_LEVEL);
+    const string level_name = lid.describe();
+    vector<vector<unsigned char>> sections;
+    tag_write_level_sections(sections);
+
+    const bool have_stored = _stored_level == level_name;
+    for (int i = LEVEL_SECTION_HEADER + 1; i < NUM_LEVEL_SECTIONS; ++i)
+    {
+        const string chunk = _level_section_chunk(level_name, i);
+        if (have_stored && sections[i] == _stored_sections[i]
+            && you.save->has_chunk(chunk))
+        {
+            continue;
+        }
+
+        writer outf(you.save, chunk);
+        outf.write(sections[i].data(), sections[i].size());
+    }
+
+    // The level's own chunk goes last: it's what marks the level as saved.
+    writer outf(you.save, level_name);
+    marshallUByte(outf, TAG_MAJOR_VERSION);
+    marshallUByte(outf, TAG_MINOR_VERSION);
+    outf.write(sections[LEVEL_SECTION_HEADER].data(),
+               sections[LEVEL_SECTION_HEADER].size());
+
+    _stored_level = level_name;
+    _stored_sections = move(sections);
 }
 
 #if TAG_MAJOR_VERSION == 34
@@ -2659,6 +2721,10 @@ static bool _restore_game(const string& filename)
     clear_message_store();
 
     you.save = new package((_get_savefile_directory() + filename).c_str(), true);
+    _forget_stored_level();
+    you.save->set_compression(
+        static_cast<save_compression_type>(Options.save_compression));
+    you.save->set_background_writes(Options.background_save);
 
     if (!_read_char_chunk(you.save))
     {
@@ -2833,7 +2899,17 @@ void delete_level(const level_id &level)
     clear_level_annotations(level);
 
     if (you.save)
-        you.save->delete_chunk(level.describe());
+    {
+        const string level_name = level.describe();
+        for (int i = 0; i < NUM_LEVEL_SECTIONS; ++i)
+        {
+            const string chunk = _level_section_chunk(level_name, i);
+            if (you.save->has_chunk(chunk))
+                you.save->delete_chunk(chunk);
+        }
+        if (_stored_level == level_name)
+            _forget_stored_level();
+    }
 
     auto &visited = you.props[VISITED_LEVELS_KEY].get_table();
     visited.erase(level.describe());
@@ -3040,6 +3116,79 @@ static bool _restore_tagged_chunk(package *save, const string &name,
     return true;
 }
 
+static void _read_section_chunk(const string &name, vector<unsigned char> &data)
+{
+    vector<char> raw;
+    chunk_reader(you.save, name).read_all(raw);
+    data.assign(raw.begin(), raw.end());
+}
+
+// Load a level saved by _save_level(), or by older versions as a single chunk.
+static void _restore_level(const string &level_name)
+{
+    vector<vector<unsigned char>> sections(NUM_LEVEL_SECTIONS);
+    _read_section_chunk(level_name, sections[LEVEL_SECTION_HEADER]);
+
+    int minor;
+    {
+        reader inf(sections[LEVEL_SECTION_HEADER]);
+        string reason;
+        if (!_tagged_chunk_version_compatible(inf, &reason))
+            end(-1, false, "\nLevel file is invalid. %s\n", reason.c_str());
+        minor = inf.getMinorVersion();
+    }
+
+#if TAG_MAJOR_VERSION == 34
+    if (minor < TAG_MINOR_LEVEL_SECTIONS)
+    {
+        _forget_stored_level();
+        _restore_tagged_chunk(you.save, level_name, TAG_LEVEL,
+                              "Level file is invalid.");
+        return;
+    }
+#endif
+
+    // Strip the version, then put the sections back together in the form
+    // tag_write(TAG_LEVEL) would have produced.
+    sections[LEVEL_SECTION_HEADER].erase(sections[LEVEL_SECTION_HEADER].begin(),
+                                         sections[LEVEL_SECTION_HEADER].begin() + 2);
+    size_t size = 0;
+    for (int i = 0; i < NUM_LEVEL_SECTIONS; ++i)
+    {
+        if (i != LEVEL_SECTION_HEADER)
+        {
+            const string chunk = _level_section_chunk(level_name, i);
+            if (!you.save->has_chunk(chunk))
+                corrupted("level chunk %s is missing", chunk.c_str());
+            _read_section_chunk(chunk, sections[i]);
+        }
+        size += sections[i].size();
+    }
+
+    vector<unsigned char> buf;
+    {
+        writer th(&buf);
+        marshallInt(th, size);
+        for (const auto &section : sections)
+            th.write(section.data(), section.size());
+    }
+
+    reader inf(buf, minor);
+    crawl_state.minor_version = minor;
+    try
+    {
+        tag_read(inf, TAG_LEVEL);
+    }
+    catch (short_read_exception &E)
+    {
+        fail("truncated save chunk (%s)", level_name.c_str());
+    };
+    inf.fail_if_not_eof(level_name);
+
+    _stored_level = level_name;
+    _stored_sections = move(sections);
+}
+
 static bool _ghost_version_compatible(const save_version &version)
 {
     if (!version.valid())
@@ -3335,6 +3484,59 @@ file_lock::~file_lock()
         lk_close(handle);
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// mapped_file
+//
+// Gives read-only access to the contents of a file. Where possible the file
+// is mapped; otherwise it is read into memory.
+
+mapped_file::mapped_file(const string &filename)
+    : ok(false), mapped(false), bytes(nullptr), length(0)
+{
+#ifdef UNIX
+    const int fd = open_u(filename.c_str(), O_RDONLY, 0);
+    if (fd != -1)
+    {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED,
+                             fd, 0);
+            if (map != MAP_FAILED)
+            {
+                bytes  = static_cast<const unsigned char *>(map);
+                length = st.st_size;
+                mapped = ok = true;
+            }
+        }
+        close(fd);
+        if (ok)
+            return;
+    }
+#endif
+
+    FILE *fp = fopen_u(filename.c_str(), "rb");
+    if (!fp)
+        return;
+
+    contents.resize(file_size(fp));
+    if (fread(contents.data(), 1, contents.size(), fp) == contents.size())
+    {
+        bytes  = contents.data();
+        length = contents.size();
+        ok = true;
+    }
+    fclose(fp);
+}
+
+mapped_file::~mapped_file()
+{
+#ifdef UNIX
+    if (mapped)
+        munmap(const_cast<unsigned char *>(bytes), length);
+#endif
+}
+
 /////////////////////////////////////////////////////////////////////////////
 
 FILE *fopen_replace(const char *name)
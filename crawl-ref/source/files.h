@@ -142,4 +142,24 @@ private:
     string filename;
 };
 
+class mapped_file
+{
+public:
+    mapped_file(const string &filename);
+    ~mapped_file();
+
+    bool valid() const { return ok; }
+    const unsigned char *data() const { return bytes; }
+    size_t size() const { return length; }
+private:
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    bool ok;
+    bool mapped;
+    const unsigned char *bytes;
+    size_t length;
+    vector<unsigned char> contents;
+};
+
 FILE *fopen_replace(const char *name);
@@ -217,6 +217,7 @@ const vector<GameOption*> game_options::build_options_list()
         new BoolGameOption(SIMPLE_NAME(explore_auto_rest), false),
         new BoolGameOption(SIMPLE_NAME(travel_key_stop), true),
         new BoolGameOption(SIMPLE_NAME(dump_on_save), true),
+        new BoolGameOption(SIMPLE_NAME(background_save), false),
         new BoolGameOption(SIMPLE_NAME(rest_wait_both), false),
         new BoolGameOption(SIMPLE_NAME(rest_wait_ancestor), false),
         new BoolGameOption(SIMPLE_NAME(cloud_status), !is_tiles()),
@@ -387,6 +388,7 @@ const vector<GameOption*> game_options::build_options_list()
         new BoolGameOption(SIMPLE_NAME(tile_level_map_hide_messages), true),
         new BoolGameOption(SIMPLE_NAME(tile_level_map_hide_sidebar), false),
         new BoolGameOption(SIMPLE_NAME(tile_web_mouse_control), true),
+        new IntGameOption(SIMPLE_NAME(tile_web_frame_rate), 30, 0, 1000),
         new StringGameOption(SIMPLE_NAME(tile_font_crt_family), "monospace"),
         new StringGameOption(SIMPLE_NAME(tile_font_msg_family), "monospace"),
         new StringGameOption(SIMPLE_NAME(tile_font_stat_family), "monospace"),
@@ -1118,6 +1120,7 @@ void game_options::reset_options()
     explore_mode         = WIZ_NO;
 #endif
 #endif
+    save_compression     = SAVE_COMPRESSION_DEFAULT;
     terp_files.clear();
 
 #ifdef USE_TILE_LOCAL
@@ -2983,6 +2986,20 @@ void game_options::read_option_line(const string &str, bool runscript)
     #endif
 #endif
     }
+    else if (key == "save_compression")
+    {
+        if (field == "default")
+            save_compression = SAVE_COMPRESSION_DEFAULT;
+        else if (field == "fast")
+            save_compression = SAVE_COMPRESSION_FAST;
+        else if (field == "none")
+            save_compression = SAVE_COMPRESSION_NONE;
+        else
+        {
+            report_error("Unknown save_compression option: %s\n",
+                         field.c_str());
+        }
+    }
     else if (key == "ban_pickup")
     {
         // Only remove negative, not positive, exceptions.
@@ -3913,6 +3930,7 @@ enum commandline_option_type
     CLO_TEST,
     CLO_SCRIPT,
     CLO_BUILDDB,
+    CLO_STARTUP_PROFILE,
     CLO_HELP,
     CLO_VERSION,
     CLO_SEED,
@@ -3938,6 +3956,12 @@ enum commandline_option_type
     CLO_WEBTILES_SOCKET,
     CLO_AWAIT_CONNECTION,
     CLO_PRINT_WEBTILES_OPTIONS,
+    CLO_WEBTILES_COMPARE_ENCODINGS,
+    CLO_WEBTILES_RECORD,
+    CLO_WEBTILES_REPLAY,
+    CLO_WEBTILES_OUTPUT,
+    CLO_WEBTILES_REPLAY_COMPACT,
+    CLO_WEBTILES_REPLAY_DEFLATE,
 #endif
 
     CLO_NOPS
@@ -3948,13 +3972,16 @@ static const char *cmd_ops[] =
     "scores", "name", "species", "background", "dir", "rc", "rcdir", "tscores",
     "vscores", "scorefile", "morgue", "macro", "mapstat", "dump-disconnect",
     "objstat", "iters", "force-map", "arena", "dump-maps", "test", "script",
-    "builddb", "help", "version", "seed", "pregen", "save-version", "sprint",
+    "builddb", "startup-profile", "help", "version", "seed", "pregen",
+    "save-version", "sprint",
     "extra-opt-first", "extra-opt-last", "sprint-map", "edit-save",
     "print-charset", "tutorial", "wizard", "explore", "no-save", "gdb",
     "no-gdb", "nogdb", "throttle", "no-throttle", "playable-json",
     "bones",
 #ifdef USE_TILE_WEB
     "webtiles-socket", "await-connection", "print-webtiles-options",
+    "webtiles-compare-encodings", "webtiles-record", "webtiles-replay",
+    "webtiles-output", "webtiles-replay-compact", "webtiles-replay-deflate",
 #endif
 };
 
@@ -4903,6 +4930,15 @@ bool parse_args(int argc, char **argv, bool rc_only)
 #endif
             break;
 
+        case CLO_STARTUP_PROFILE:
+            if (next_is_param)
+                return false;
+            crawl_state.startup_profile = true;
+#ifdef USE_TILE_LOCAL
+            crawl_state.tiles_disabled = true;
+#endif
+            break;
+
         case CLO_GDB:
             crawl_state.no_gdb = 0;
             break;
@@ -5084,6 +5120,49 @@ bool parse_args(int argc, char **argv, bool rc_only)
                 end(0);
             }
             break;
+
+        case CLO_WEBTILES_COMPARE_ENCODINGS:
+            if (!next_is_param)
+                return false;
+            nextUsed = true;
+            if (!rc_only)
+            {
+                tiles.compare_encodings(next_arg);
+                end(0);
+            }
+            break;
+
+        case CLO_WEBTILES_RECORD:
+            if (!next_is_param)
+                return false;
+            nextUsed           = true;
+            tiles.m_record_name = next_arg;
+            break;
+
+        case CLO_WEBTILES_REPLAY:
+            if (!next_is_param)
+                return false;
+            nextUsed           = true;
+            tiles.m_replay_name = next_arg;
+            // Leave the real game's saves alone.
+            if (!rc_only)
+                Options.no_save = true;
+            break;
+
+        case CLO_WEBTILES_OUTPUT:
+            if (!next_is_param)
+                return false;
+            nextUsed           = true;
+            tiles.m_output_name = next_arg;
+            break;
+
+        case CLO_WEBTILES_REPLAY_COMPACT:
+            tiles.m_replay_compact = true;
+            break;
+
+        case CLO_WEBTILES_REPLAY_DEFLATE:
+            tiles.m_replay_deflate = true;
+            break;
 #endif
 
         case CLO_PRINT_CHARSET:
@@ -5,6 +5,8 @@
 
 #include "l-libs.h"
 
+#include <chrono>
+
 #include "act-iter.h"
 #include "branch.h"
 #include "chardump.h"
@@ -14,6 +16,7 @@
 #include "dungeon.h"
 #include "files.h"
 #include "god-wrath.h"
+#include "items.h"
 #include "los.h"
 #include "message.h"
 #include "mon-act.h"
@@ -24,7 +27,12 @@
 #include "stairs.h"
 #include "state.h"
 #include "stringutil.h"
+#include "tags.h"
+#ifdef USE_TILE_WEB
+ #include "tileweb.h"
+#endif
 #include "tileview.h"
+#include "travel.h"
 #include "view.h"
 #include "wiz-dgn.h"
 
@@ -433,6 +441,249 @@ LUAFN(debug_get_rng_state)
     return 1;
 }
 
+// Usage: write_ms, read_ms, bytes = level_roundtrip(<iterations>)
+// Saves the current level to a chunk of a scratch package the way a level
+// save does and reads it back in place, reporting the total time spent in
+// each direction and the size of the stored chunk. Used by
+// scripts/level-save-bench.lua.
+LUAFN(debug_level_roundtrip)
+{
+    const int iterations = lua_isnumber(ls, 1) ? luaL_safe_checkint(ls, 1)
+                                               : 1;
+    if (iterations < 1)
+        luaL_argerror(ls, 1, "need at least one iteration");
+
+    const string file = savedir_versioned_path("level-roundtrip.tmp");
+    const string chunk = "level";
+    package save(file.c_str(), true, true);
+    save.set_compression(
+        static_cast<save_compression_type>(Options.save_compression));
+
+    no_messages mx;
+    chrono::steady_clock::duration write_time(0), read_time(0);
+    for (int i = 0; i < iterations; ++i)
+    {
+        fix_item_coordinates();
+
+        auto start = chrono::steady_clock::now();
+        {
+            writer outf(&save, chunk);
+            tag_write(TAG_LEVEL, outf);
+        }
+        write_time += chrono::steady_clock::now() - start;
+
+        start = chrono::steady_clock::now();
+        {
+            reader inf(&save, chunk, TAG_MINOR_VERSION);
+            tag_read(inf, TAG_LEVEL);
+        }
+        read_time += chrono::steady_clock::now() - start;
+    }
+    save.commit();
+    const plen_t bytes = save.get_chunk_compressed_length(chunk);
+    save.unlink();
+
+    lua_pushnumber(ls,
+        chrono::duration<double, milli>(write_time).count());
+    lua_pushnumber(ls,
+        chrono::duration<double, milli>(read_time).count());
+    lua_pushnumber(ls, bytes);
+    return 3;
+}
+
+#ifndef NO_LOS_BITBOARD
+// Usage: bitvector_ms, bitboard_ms, centres, mismatches = los_bench(<iterations>)
+// Computes default LOS from every cell within LOS range of the player with
+// both losight() implementations, reporting the total time spent in each and
+// how many centres they disagreed on. Used by scripts/los-bench.lua.
+LUAFN(debug_los_bench)
+{
+    const int iterations = lua_isnumber(ls, 1) ? luaL_safe_checkint(ls, 1)
+                                               : 1;
+    if (iterations < 1)
+        luaL_argerror(ls, 1, "need at least one iteration");
+
+    vector<coord_def> centres;
+    for (radius_iterator ri(you.pos(), LOS_MAX_RANGE, C_SQUARE); ri; ++ri)
+        if (map_bounds(*ri))
+            centres.push_back(*ri);
+
+    int mismatches = 0;
+    for (const coord_def &c : centres)
+    {
+        los_grid a, b;
+        losight_bitvector(a, c, opc_default, BDS_DEFAULT);
+        losight_bitboard(b, c, opc_default, BDS_DEFAULT);
+        for (rectangle_iterator ri(coord_def(-LOS_MAX_RANGE, -LOS_MAX_RANGE),
+                                   coord_def(LOS_MAX_RANGE, LOS_MAX_RANGE));
+             ri; ++ri)
+        {
+            if (a(*ri) != b(*ri))
+            {
+                ++mismatches;
+                break;
+            }
+        }
+    }
+
+    los_grid sh;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        for (const coord_def &c : centres)
+            losight_bitvector(sh, c, opc_default, BDS_DEFAULT);
+    const auto bitvector_time = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        for (const coord_def &c : centres)
+            losight_bitboard(sh, c, opc_default, BDS_DEFAULT);
+    const auto bitboard_time = chrono::steady_clock::now() - start;
+
+    lua_pushnumber(ls,
+        chrono::duration<double, milli>(bitvector_time).count());
+    lua_pushnumber(ls,
+        chrono::duration<double, milli>(bitboard_time).count());
+    lua_pushnumber(ls, centres.size());
+    lua_pushnumber(ls, mismatches);
+    return 4;
+}
+#endif
+
+static level_id _layout_place(lua_State *ls, const char *name)
+{
+    try
+    {
+        return level_id::parse_level_id(name);
+    }
+    catch (const bad_level_id &err)
+    {
+        luaL_error(ls, err.what());
+    }
+    return level_id();
+}
+
+static int _layout_int(lua_State *ls, int index)
+{
+    lua_rawgeti(ls, -1, index);
+    const int value = luaL_safe_checkint(ls, -1);
+    lua_pop(ls, 1);
+    return value;
+}
+
+// Usage: distance, x, y = travel_route(layout, from, x, y, to, <tx>, <ty>)
+// Finds the interlevel travel route from (x, y) on the place "from" to the
+// place "to" (or to (tx, ty) on it) over a made-up layout of open levels:
+//   { ["D:1"] = { { x, y, "D:2", dest_x, dest_y }, { x, y }, ... }, ... }
+// lists each level's known stairs and, if known, where they lead. Returns
+// the route's length (-1 if there is none) and the stair to take first. Used
+// by test/travel_route.lua.
+LUAFN(debug_travel_route)
+{
+    if (!lua_istable(ls, 1))
+    {
+        luaL_argerror(ls, 1, "Must be a table");
+        return 0;
+    }
+
+    stair_layout layout;
+    lua_pushnil(ls);
+    while (lua_next(ls, 1))
+    {
+        vector<pair<coord_def, level_pos>> &stairs =
+            layout[_layout_place(ls, luaL_checkstring(ls, -2))];
+        for (int i = 1; ; ++i)
+        {
+            lua_rawgeti(ls, -1, i);
+            if (lua_isnil(ls, -1))
+            {
+                lua_pop(ls, 1);
+                break;
+            }
+
+            const coord_def pos(_layout_int(ls, 1), _layout_int(ls, 2));
+            level_pos dest;
+            lua_rawgeti(ls, -1, 3);
+            if (lua_isstring(ls, -1))
+            {
+                dest.id = _layout_place(ls, lua_tostring(ls, -1));
+                dest.pos = coord_def(_layout_int(ls, 4),
+                                     _layout_int(ls, 5));
+            }
+            lua_pop(ls, 2);
+            stairs.emplace_back(pos, dest);
+        }
+        lua_pop(ls, 1);
+    }
+
+    const level_pos from(_layout_place(ls, luaL_checkstring(ls, 2)),
+                         coord_def(luaL_safe_checkint(ls, 3),
+                                   luaL_safe_checkint(ls, 4)));
+    level_pos target;
+    target.id = _layout_place(ls, luaL_checkstring(ls, 5));
+    if (lua_isnumber(ls, 6))
+    {
+        target.pos = coord_def(luaL_safe_checkint(ls, 6),
+                               luaL_safe_checkint(ls, 7));
+    }
+
+    coord_def first_stair(-1, -1);
+    lua_pushnumber(ls, TravelCache::find_layout_route(layout, from, target,
+                                                      first_stair));
+    lua_pushnumber(ls, first_stair.x);
+    lua_pushnumber(ls, first_stair.y);
+    return 3;
+}
+
+// Usage: ok = los_ray_cache_matches()
+// Recomputes the LOS ray tables and checks them against the ones the game
+// started with and the ones read back from the ray cache. Used by
+// test/los_ray_cache.lua.
+LUAFN(debug_los_ray_cache_matches)
+{
+    lua_pushboolean(ls, los_ray_cache_matches());
+    return 1;
+}
+
+#ifdef USE_TILE_WEB
+// Usage: ms, bytes = webtiles_bench(<iterations>)
+// Maps the whole level, then encodes the full webtiles refresh a new
+// spectator would get the given number of times, reporting the total time
+// and the size of one refresh. Used by scripts/webtiles-bench.lua.
+LUAFN(debug_webtiles_bench)
+{
+    const int iterations = lua_isnumber(ls, 1) ? luaL_safe_checkint(ls, 1)
+                                               : 1;
+    if (iterations < 1)
+        luaL_argerror(ls, 1, "need at least one iteration");
+    if (tiles.has_receivers())
+        luaL_error(ls, "can't benchmark with webtiles clients attached");
+
+    fully_map_level();
+
+    size_t bytes = 0;
+    const auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        bytes = tiles.encode_everything();
+    const auto elapsed = chrono::steady_clock::now() - start;
+
+    lua_pushnumber(ls, chrono::duration<double, milli>(elapsed).count());
+    lua_pushnumber(ls, bytes);
+    return 2;
+}
+
+// Usage: ok = webtiles_refresh_syncs()
+// Checks that giving one webtiles destination a full refresh doesn't keep a
+// pending change from the others. Used by test/webtiles_refresh.lua.
+LUAFN(debug_webtiles_refresh_syncs)
+{
+    if (tiles.has_receivers())
+        luaL_error(ls, "can't check with webtiles clients attached");
+
+    lua_pushboolean(ls, tiles.refresh_keeps_others_in_sync());
+    return 1;
+}
+#endif
+
 const struct luaL_reg debug_dlib[] =
 {
 { "goto_place", debug_goto_place },
@@ -463,5 +714,15 @@ const struct luaL_reg debug_dlib[] =
 { "cpp_assert", debug_cpp_assert },
 { "reset_rng", debug_reset_rng },
 { "get_rng_state", debug_get_rng_state },
+{ "level_roundtrip", debug_level_roundtrip },
+#ifndef NO_LOS_BITBOARD
+{ "los_bench", debug_los_bench },
+#endif
+{ "los_ray_cache_matches", debug_los_ray_cache_matches },
+{ "travel_route", debug_travel_route },
+#ifdef USE_TILE_WEB
+{ "webtiles_bench", debug_webtiles_bench },
+{ "webtiles_refresh_syncs", debug_webtiles_refresh_syncs },
+#endif
 { nullptr, nullptr }
 };
@@ -1535,7 +1535,8 @@ void delay(unsigned int time)
         return;
 
 #ifdef USE_TILE_WEB
-    tiles.redraw();
+    // Whatever is drawn before a delay is meant to be seen.
+    tiles.redraw(time > 0);
     if (time)
     {
         tiles.send_message("{\"msg\":\"delay\",\"t\":%d}", time);
@@ -46,13 +46,32 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#ifndef NO_LOS_BITBOARD
+# if defined(__AVX2__)
+#  include <immintrin.h>
+#  define LOS_WORDS_AVX2
+# elif defined(__SSE2__) || defined(_M_X64) \
+       || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define LOS_WORDS_SSE2
+# endif
+# ifdef _MSC_VER
+#  include <intrin.h>
+# endif
+#endif
 
 #include "areas.h"
 #include "coord.h"
 #include "coordit.h"
 #include "env.h"
+#include "files.h"
 #include "losglobal.h"
+#include "maps.h"
 #include "mon-act.h"
+#include "syscalls.h"
+#include "tags.h"
 
 // These determine what rays are cast in the precomputation,
 // and affect start-up time significantly.
@@ -60,6 +79,10 @@
 #define LOS_MAX_ANGLE (2*LOS_MAX_RANGE-2)
 #define LOS_INTERCEPT_MULT (2)
 
+// The tables are cached in the des cache directory, keyed on the values
+// above. Bump this if the precomputation or the cache layout changes.
+#define LOS_RAY_CACHE_VERSION 1
+
 // These store all unique (in terms of footprint) full rays.
 // The footprint of ray=fullray[i] consists of ray.length cells,
 // stored in ray_coords[ray.start..ray.length-1].
@@ -90,6 +113,18 @@ static FixedArray<vector<cellray>, LOS_MAX_RANGE+1, LOS_MAX_RANGE+1> min_cellray
 static bit_vector *dead_rays     = nullptr;
 static bit_vector *smoke_rays    = nullptr;
 
+#ifndef NO_LOS_BITBOARD
+// The same blockrays as plain 64-bit words for the bitboard version of
+// losight(): the mask of quadrant cell (x, y) is the ray_words words
+// starting at _blockray_words(x, y). ray_words is padded to a multiple
+// of four so the mask operations can work a whole SIMD register at a time;
+// the padding bits are never set.
+static vector<uint64_t> blockray_words;
+static vector<uint64_t> dead_words;
+static vector<uint64_t> smoke_words;
+static int ray_words = 0;
+#endif
+
 class quadrant_iterator : public rectangle_iterator
 {
 public:
@@ -382,6 +417,8 @@ static void _register_ray(geom::ray r)
     fullrays.push_back(ray);
 }
 
+static void _init_ray_masks();
+
 static void _create_blockrays()
 {
     // First, we calculate blocking information for all cell rays.
@@ -428,13 +465,34 @@ static void _create_blockrays()
     for (quadrant_iterator qi; qi; ++qi)
         delete all_blockrays(*qi);
 
-    dead_rays  = new bit_vector(n_min_rays);
-    smoke_rays = new bit_vector(n_min_rays);
+    _init_ray_masks();
 
     dprf("Cellrays: %d Fullrays: %u Minimal cellrays: %u",
           n_cellrays, (unsigned int)fullrays.size(), n_min_rays);
 }
 
+static void _init_ray_masks()
+{
+    const int n_min_rays = cellray_ends.size();
+    dead_rays  = new bit_vector(n_min_rays);
+    smoke_rays = new bit_vector(n_min_rays);
+
+#ifndef NO_LOS_BITBOARD
+    ray_words = (n_min_rays + 255) / 256 * 4;
+    blockray_words.assign((LOS_MAX_RANGE+1) * (LOS_MAX_RANGE+1) * ray_words, 0);
+    for (quadrant_iterator qi; qi; ++qi)
+    {
+        uint64_t *mask = &blockray_words[(qi->x * (LOS_MAX_RANGE+1) + qi->y)
+                                         * ray_words];
+        for (int i = 0; i < n_min_rays; ++i)
+            if (blockrays(*qi)->get(i))
+                mask[i / 64] |= uint64_t(1) << (i % 64);
+    }
+    dead_words.resize(ray_words);
+    smoke_words.resize(ray_words);
+#endif
+}
+
 static int _gcd(int x, int y)
 {
     int tmp;
@@ -454,15 +512,10 @@ static bool _complexity_lt(const pair<int,int>& lhs, const pair<int,int>& rhs)
 }
 
 // Cast all rays
-static void raycast()
+static void _compute_ray_tables()
 {
-    static bool done_raycast = false;
-    if (done_raycast)
-        return;
-
     // Creating all rays for first quadrant
     // We have a considerable amount of overkill.
-    done_raycast = true;
 
     // register perpendiculars FIRST, to make them top choice
     // when selecting beams
@@ -506,6 +559,324 @@ static void raycast()
     _create_blockrays();
 }
 
+static void _reset_ray_tables()
+{
+    fullrays.clear();
+    ray_coords.clear();
+    cellray_ends.clear();
+    for (quadrant_iterator qi; qi; ++qi)
+    {
+        delete blockrays(*qi);
+        blockrays(*qi) = nullptr;
+        min_cellrays(*qi).clear();
+    }
+    delete dead_rays;
+    dead_rays = nullptr;
+    delete smoke_rays;
+    smoke_rays = nullptr;
+#ifndef NO_LOS_BITBOARD
+    blockray_words.clear();
+    dead_words.clear();
+    smoke_words.clear();
+    ray_words = 0;
+#endif
+}
+
+static void _marshall_double(writer &th, double d)
+{
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    marshallUnsigned(th, bits);
+}
+
+static double _unmarshall_double(reader &th)
+{
+    const uint64_t bits = unmarshallUnsigned(th);
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+// Writes everything the precomputation leaves behind, except what
+// _init_ray_masks() derives and the fullrays only needed while building.
+static void _write_ray_tables(writer &th)
+{
+    marshallInt(th, LOS_RAY_CACHE_VERSION);
+    marshallInt(th, LOS_MAX_RANGE);
+    marshallInt(th, LOS_MAX_ANGLE);
+    marshallInt(th, LOS_INTERCEPT_MULT);
+
+    marshallInt(th, ray_coords.size());
+    for (const coord_def &c : ray_coords)
+        marshallCoord(th, c);
+
+    const int n_min_rays = cellray_ends.size();
+    marshallInt(th, n_min_rays);
+    for (const coord_def &c : cellray_ends)
+        marshallCoord(th, c);
+
+    for (quadrant_iterator qi; qi; ++qi)
+    {
+        const vector<cellray> &min = min_cellrays(*qi);
+        marshallInt(th, min.size());
+        for (const cellray &c : min)
+        {
+            _marshall_double(th, c.ray.r.start.x);
+            _marshall_double(th, c.ray.r.start.y);
+            _marshall_double(th, c.ray.r.dir.x);
+            _marshall_double(th, c.ray.r.dir.y);
+            marshallBoolean(th, c.ray.on_corner);
+            marshallInt(th, c.ray.cycle_idx);
+            marshallInt(th, c.ray.start);
+            marshallInt(th, c.ray.length);
+            marshallInt(th, c.end);
+            marshallInt(th, c.imbalance);
+            marshallBoolean(th, c.first_diag);
+        }
+
+        for (int i = 0; i < n_min_rays; i += 8)
+        {
+            uint8_t bits = 0;
+            for (int j = 0; j < 8 && i + j < n_min_rays; ++j)
+                if (blockrays(*qi)->get(i + j))
+                    bits |= 1 << j;
+            marshallUByte(th, bits);
+        }
+    }
+}
+
+// Whether c lies in the quadrant the tables cover; their coordinates are
+// used to index arrays sized by it.
+static bool _in_ray_quadrant(const coord_def &c)
+{
+    return c.x >= 0 && c.x <= LOS_MAX_RANGE
+           && c.y >= 0 && c.y <= LOS_MAX_RANGE;
+}
+
+// Reads tables written by _write_ray_tables(), returning false if they
+// were built with different parameters or are inconsistent. The tables
+// must be empty beforehand.
+static bool _read_ray_tables(reader &th)
+{
+    // Anything bigger than this is a corrupt file, not a ray table.
+    const int max_entries = 1 << 20;
+
+    if (unmarshallInt(th) != LOS_RAY_CACHE_VERSION
+        || unmarshallInt(th) != LOS_MAX_RANGE
+        || unmarshallInt(th) != LOS_MAX_ANGLE
+        || unmarshallInt(th) != LOS_INTERCEPT_MULT)
+    {
+        return false;
+    }
+
+    const int n_coords = unmarshallInt(th);
+    if (n_coords < 0 || n_coords > max_entries)
+        return false;
+    ray_coords.resize(n_coords);
+    for (coord_def &c : ray_coords)
+    {
+        c = unmarshallCoord(th);
+        if (!_in_ray_quadrant(c))
+            return false;
+    }
+
+    const int n_min_rays = unmarshallInt(th);
+    if (n_min_rays < 0 || n_min_rays > max_entries)
+        return false;
+    cellray_ends.resize(n_min_rays);
+    for (coord_def &c : cellray_ends)
+    {
+        c = unmarshallCoord(th);
+        if (!_in_ray_quadrant(c))
+            return false;
+    }
+
+    // _create_blockrays() numbers the minimal cellrays by target, in
+    // quadrant order, so the cellrays for each cell have the next run of
+    // cellray_ends, and all of them end in that cell.
+    int next_end = 0;
+    for (quadrant_iterator qi; qi; ++qi)
+    {
+        const int n_min = unmarshallInt(th);
+        if (n_min < 0 || n_min > max_entries)
+            return false;
+        vector<cellray> &min = min_cellrays(*qi);
+        min.reserve(n_min);
+        for (int i = 0; i < n_min; ++i)
+        {
+            los_ray ray(geom::ray(0, 0, 0, 0));
+            ray.r.start.x = _unmarshall_double(th);
+            ray.r.start.y = _unmarshall_double(th);
+            ray.r.dir.x = _unmarshall_double(th);
+            ray.r.dir.y = _unmarshall_double(th);
+            ray.on_corner = unmarshallBoolean(th);
+            ray.cycle_idx = unmarshallInt(th);
+            ray.start = unmarshallInt(th);
+            ray.length = unmarshallInt(th);
+            cellray c(ray, unmarshallInt(th));
+            c.imbalance = unmarshallInt(th);
+            c.first_diag = unmarshallBoolean(th);
+            if (ray.length > (unsigned int)n_coords
+                || ray.start > (unsigned int)n_coords - ray.length
+                || c.end >= ray.length
+                || c.target() != *qi
+                || next_end >= n_min_rays
+                || cellray_ends[next_end++] != *qi)
+            {
+                return false;
+            }
+            min.push_back(c);
+        }
+
+        blockrays(*qi) = new bit_vector(n_min_rays);
+        for (int i = 0; i < n_min_rays; i += 8)
+        {
+            const uint8_t bits = unmarshallUByte(th);
+            for (int j = 0; j < 8 && i + j < n_min_rays; ++j)
+                if (bits & (1 << j))
+                    blockrays(*qi)->set(i + j);
+        }
+    }
+
+    if (next_end != n_min_rays)
+        return false;
+
+    _init_ray_masks();
+    return true;
+}
+
+static string _ray_cache_path()
+{
+    return get_descache_path("los_rays", ".cache");
+}
+
+// Reads a ray cache's contents: the header, then the tables. On failure the
+// tables are left empty.
+static bool _load_ray_tables(const unsigned char *data, size_t size)
+{
+    reader inf(data, size, TAG_MINOR_VERSION);
+    inf.set_safe_read(true);
+
+    // The tables have no source file, so the header's mtime is always 0.
+    bool ok = false;
+    try
+    {
+        ok = verify_descache_header(inf, 0) && _read_ray_tables(inf);
+    }
+    catch (short_read_exception &E)
+    {
+    }
+
+    if (!ok)
+        _reset_ray_tables();
+    return ok;
+}
+
+static void _write_ray_cache(writer &outf)
+{
+    write_descache_header(outf, 0);
+    _write_ray_tables(outf);
+}
+
+static bool _load_ray_cache()
+{
+    mapped_file cache(_ray_cache_path());
+    return cache.valid() && _load_ray_tables(cache.data(), cache.size());
+}
+
+// Returns whether the cache was written.
+static bool _save_ray_cache()
+{
+    // Every process that finds no cache computes the tables and saves them;
+    // the lock stops two of them sharing a temporary, and the rename keeps
+    // readers from seeing a partial cache.
+    const string cachefile = _ray_cache_path();
+    FILE *lock = lk_open("wb", cachefile + ".lk");
+    if (!lock)
+        return false;
+
+    bool saved = false;
+    const string tmpfile = cachefile + ".tmp";
+    if (FILE *fp = fopen_replace(tmpfile.c_str()))
+    {
+        writer outf(tmpfile, fp, true);
+        _write_ray_cache(outf);
+        saved = fclose(fp) == 0 && outf.succeeded()
+                && !rename_u(tmpfile.c_str(), cachefile.c_str());
+        if (!saved)
+            unlink_u(tmpfile.c_str());
+    }
+    lk_close(lock);
+    return saved;
+}
+
+static bool done_raycast = false;
+
+// Set up the ray tables, from the cache if there's a usable one.
+static void raycast()
+{
+    if (done_raycast)
+        return;
+    done_raycast = true;
+
+    if (_load_ray_cache())
+        return;
+
+    _compute_ray_tables();
+    _save_ray_cache();
+}
+
+bool los_ray_cache_matches()
+{
+    auto serialise = []()
+    {
+        vector<unsigned char> buf;
+        writer outf(&buf);
+        _write_ray_tables(outf);
+        return buf;
+    };
+
+    // Whatever this process started with, from the cache or not.
+    raycast();
+    const vector<unsigned char> initial = serialise();
+
+    _reset_ray_tables();
+    _compute_ray_tables();
+    const vector<unsigned char> computed = serialise();
+
+    // Read the tables back from a cache built in memory, so the check works
+    // even without a writable des cache...
+    vector<unsigned char> cache;
+    {
+        writer outf(&cache);
+        _write_ray_cache(outf);
+    }
+    _reset_ray_tables();
+    bool ok = _load_ray_tables(cache.data(), cache.size())
+              && serialise() == computed;
+
+    // ...and from the cache file, if it can be written.
+    if (ok && _save_ray_cache())
+    {
+        _reset_ray_tables();
+        ok = _load_ray_cache() && serialise() == computed;
+    }
+
+    if (!ok)
+    {
+        _reset_ray_tables();
+        _compute_ray_tables();
+    }
+    return ok && initial == computed;
+}
+
+// The ray tables are otherwise set up on first use; this lets startup
+// profiling time them on their own.
+void precompute_los_rays()
+{
+    raycast();
+}
+
 static int _imbalance(ray_def ray, const coord_def& target)
 {
     int imb = 0;
@@ -836,6 +1207,158 @@ static void _losight_quadrant(los_grid& sh, const los_param& dat, int sx, int sy
     }
 }
 
+static const int quadrant_x[4] = {  1, -1, -1,  1 };
+static const int quadrant_y[4] = {  1,  1, -1, -1 };
+
+#ifndef NO_LOS_BITBOARD
+static inline const uint64_t *_blockray_words(int x, int y)
+{
+    return &blockray_words[(x * (LOS_MAX_RANGE+1) + y) * ray_words];
+}
+
+static inline int _lowest_bit(uint64_t bits)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(bits);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long i;
+    _BitScanForward64(&i, bits);
+    return i;
+#else
+    int i = 0;
+    while (!(bits & 1))
+        bits >>= 1, ++i;
+    return i;
+#endif
+}
+
+// dst |= src, over ray_words words.
+static inline void _or_words(uint64_t *dst, const uint64_t *src)
+{
+#if defined(LOS_WORDS_AVX2)
+    for (int i = 0; i < ray_words; i += 4)
+    {
+        __m256i *d = (__m256i *)(dst + i);
+        _mm256_storeu_si256(d, _mm256_or_si256(_mm256_loadu_si256(d),
+                               _mm256_loadu_si256((const __m256i *)(src + i))));
+    }
+#elif defined(LOS_WORDS_SSE2)
+    for (int i = 0; i < ray_words; i += 2)
+    {
+        __m128i *d = (__m128i *)(dst + i);
+        _mm_storeu_si128(d, _mm_or_si128(_mm_loadu_si128(d),
+                            _mm_loadu_si128((const __m128i *)(src + i))));
+    }
+#else
+    for (int i = 0; i < ray_words; ++i)
+        dst[i] |= src[i];
+#endif
+}
+
+// dst |= a & b, over ray_words words.
+static inline void _or_and_words(uint64_t *dst, const uint64_t *a,
+                                 const uint64_t *b)
+{
+#if defined(LOS_WORDS_AVX2)
+    for (int i = 0; i < ray_words; i += 4)
+    {
+        __m256i *d = (__m256i *)(dst + i);
+        const __m256i ab =
+            _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(a + i)),
+                             _mm256_loadu_si256((const __m256i *)(b + i)));
+        _mm256_storeu_si256(d, _mm256_or_si256(_mm256_loadu_si256(d), ab));
+    }
+#elif defined(LOS_WORDS_SSE2)
+    for (int i = 0; i < ray_words; i += 2)
+    {
+        __m128i *d = (__m128i *)(dst + i);
+        const __m128i ab =
+            _mm_and_si128(_mm_loadu_si128((const __m128i *)(a + i)),
+                          _mm_loadu_si128((const __m128i *)(b + i)));
+        _mm_storeu_si128(d, _mm_or_si128(_mm_loadu_si128(d), ab));
+    }
+#else
+    for (int i = 0; i < ray_words; ++i)
+        dst[i] |= a[i] & b[i];
+#endif
+}
+
+// The LOS window around the centre, split into the four quadrants that
+// _losight_quadrant looks at. Row y of a quadrant has bit x set if cell
+// (sx*x, sy*y) is in bounds, or opaque, or half-opaque. Cells on the axes
+// belong to two quadrants and the centre to all four, as before.
+struct los_window
+{
+    uint64_t bounds[4][LOS_MAX_RANGE+1];
+    uint64_t opaque[4][LOS_MAX_RANGE+1];
+    uint64_t half[4][LOS_MAX_RANGE+1];
+};
+
+static void _fill_los_window(los_window& win, const los_param& dat)
+{
+    memset(&win, 0, sizeof(win));
+
+    for (int y = -LOS_MAX_RANGE; y <= LOS_MAX_RANGE; ++y)
+        for (int x = -LOS_MAX_RANGE; x <= LOS_MAX_RANGE; ++x)
+        {
+            const coord_def p(x, y);
+            if (!dat.los_bounds(p))
+                continue;
+
+            const opacity_type opc = dat.opacity(p);
+            const uint64_t bit = uint64_t(1) << abs(x);
+            for (int q = 0; q < 4; ++q)
+            {
+                if (x * quadrant_x[q] < 0 || y * quadrant_y[q] < 0)
+                    continue;
+                win.bounds[q][abs(y)] |= bit;
+                if (opc == OPC_OPAQUE)
+                    win.opaque[q][abs(y)] |= bit;
+                else if (opc == OPC_HALF)
+                    win.half[q][abs(y)] |= bit;
+            }
+        }
+}
+
+// As _losight_quadrant, but with the opacities already packed into bit rows
+// and the ray masks combined a word (or register) at a time.
+static void _losight_quadrant_bitboard(los_grid& sh, const los_window& win,
+                                       int q)
+{
+    const int num_cellrays = cellray_ends.size();
+    uint64_t *dead = &dead_words[0];
+    uint64_t *smoke = &smoke_words[0];
+
+    fill(dead_words.begin(), dead_words.end(), 0);
+    fill(smoke_words.begin(), smoke_words.end(), 0);
+
+    for (int y = 0; y <= LOS_MAX_RANGE; ++y)
+    {
+        for (uint64_t bits = win.opaque[q][y]; bits; bits &= bits - 1)
+            _or_words(dead, _blockray_words(_lowest_bit(bits), y));
+
+        for (uint64_t bits = win.half[q][y]; bits; bits &= bits - 1)
+        {
+            const uint64_t *mask = _blockray_words(_lowest_bit(bits), y);
+            _or_and_words(dead, smoke, mask);
+            _or_words(smoke, mask);
+        }
+    }
+
+    for (int w = 0; w < ray_words; ++w)
+        for (uint64_t alive = ~dead[w]; alive; alive &= alive - 1)
+        {
+            const int rayidx = w * 64 + _lowest_bit(alive);
+            if (rayidx >= num_cellrays)
+                break;
+
+            const coord_def &end = cellray_ends[rayidx];
+            if (win.bounds[q][end.y] & uint64_t(1) << end.x)
+                sh(coord_def(quadrant_x[q] * end.x, quadrant_y[q] * end.y)) = true;
+        }
+}
+#endif
+
 struct los_param_funcs : public los_param
 {
     coord_def center;
@@ -859,8 +1382,8 @@ struct los_param_funcs : public los_param
     }
 };
 
-void losight(los_grid& sh, const coord_def& center,
-             const opacity_func& opc, const circle_def& bounds)
+void losight_bitvector(los_grid& sh, const coord_def& center,
+                       const opacity_func& opc, const circle_def& bounds)
 {
     const los_param& dat = los_param_funcs(center, opc, bounds);
 
@@ -869,8 +1392,6 @@ void losight(los_grid& sh, const coord_def& center,
     // Do precomputations if necessary.
     raycast();
 
-    const int quadrant_x[4] = {  1, -1, -1,  1 };
-    const int quadrant_y[4] = {  1,  1, -1, -1 };
     for (int q = 0; q < 4; ++q)
         _losight_quadrant(sh, dat, quadrant_x[q], quadrant_y[q]);
 
@@ -879,6 +1400,38 @@ void losight(los_grid& sh, const coord_def& center,
     sh(o) = true;
 }
 
+#ifndef NO_LOS_BITBOARD
+void losight_bitboard(los_grid& sh, const coord_def& center,
+                      const opacity_func& opc, const circle_def& bounds)
+{
+    const los_param& dat = los_param_funcs(center, opc, bounds);
+
+    sh.init(false);
+
+    // Do precomputations if necessary.
+    raycast();
+
+    los_window win;
+    _fill_los_window(win, dat);
+    for (int q = 0; q < 4; ++q)
+        _losight_quadrant_bitboard(sh, win, q);
+
+    // Center is always visible.
+    const coord_def o = coord_def(0,0);
+    sh(o) = true;
+}
+#endif
+
+void losight(los_grid& sh, const coord_def& center,
+             const opacity_func& opc, const circle_def& bounds)
+{
+#ifdef NO_LOS_BITBOARD
+    losight_bitvector(sh, center, opc, bounds);
+#else
+    losight_bitboard(sh, center, opc, bounds);
+#endif
+}
+
 opacity_type mons_opacity(const monster* mon, los_type how)
 {
     // no regard for LOS_ARENA
@@ -42,9 +42,21 @@ bool cell_see_cell_nocache(const coord_def& p1, const coord_def& p2);
 typedef SquareArray<bool, LOS_MAX_RANGE> los_grid;
 
 void clear_rays_on_exit();
+void precompute_los_rays();
+// Recomputes the ray tables and checks that they match both the tables this
+// process started with and the ones read back from the ray cache. For tests.
+bool los_ray_cache_matches();
 void losight(los_grid& sh, const coord_def& center,
              const opacity_func &opc = opc_default,
              const circle_def &bds = BDS_DEFAULT);
+// The implementations losight() picks between; unless built with
+// NO_LOS_BITBOARD, it uses losight_bitboard().
+void losight_bitvector(los_grid& sh, const coord_def& center,
+                       const opacity_func &opc, const circle_def &bds);
+#ifndef NO_LOS_BITBOARD
+void losight_bitboard(los_grid& sh, const coord_def& center,
+                      const opacity_func &opc, const circle_def &bds);
+#endif
 
 void los_actor_moved(const actor* act, const coord_def& oldpos);
 void los_monster_died(const monster* mon);
@@ -2,10 +2,16 @@
 
 #include "losglobal.h"
 
+#include <list>
+#include <memory>
+
 #include "coord.h"
 #include "coordit.h"
+#include "externs.h"
 #include "libutil.h"
+#include "los.h"
 #include "los-def.h"
+#include "losparam.h"
 
 #define LOS_KNOWN 4
 
@@ -17,6 +23,28 @@ typedef halflos_t globallos_t[GXM][GYM];
 
 static globallos_t globallos;
 
+// The opacity of each cell to every los_type that globallos caches, two bits
+// per type.
+typedef uint8_t cellopacity_t;
+typedef cellopacity_t opacitymap_t[GXM][GYM];
+
+// globallos as it was when the player left a level, together with the
+// opacities it was computed from.
+struct stashed_los
+{
+    level_id place;
+    int radius;
+    opacitymap_t opacity;
+    globallos_t los;
+};
+
+// Most recently left first. Each entry is a bit under a megabyte.
+static list<unique_ptr<stashed_los>> stashed;
+static const size_t MAX_STASHED_LOS = 3;
+
+// Past this many changed cells it is cheaper to start over.
+static const size_t MAX_STASH_CHANGES = 256;
+
 static losfield_t* _lookup_globallos(const coord_def& p, const coord_def& q)
 {
     COMPILE_CHECK(LOS_KNOWN * 2 <= sizeof(losfield_t) * 8);
@@ -76,6 +104,78 @@ void invalidate_los()
         memset(globallos[ri->x][ri->y], 0, sizeof(halflos_t));
 }
 
+static cellopacity_t _cell_opacity(const coord_def& p)
+{
+    COMPILE_CHECK(NUM_OPACITIES <= 4);
+
+    return opc_default(p)
+           | opc_no_trans(p) << 2
+           | opc_solid(p) << 4
+           | opc_solid_see(p) << 6;
+}
+
+// Remember what has been worked out about the current level, which is about
+// to be left for another.
+void stash_los(const level_id &place)
+{
+    unique_ptr<stashed_los> st;
+    for (auto i = stashed.begin(); i != stashed.end(); ++i)
+        if ((*i)->place == place)
+        {
+            st = move(*i);
+            stashed.erase(i);
+            break;
+        }
+
+    if (!st)
+    {
+        if (stashed.size() >= MAX_STASHED_LOS)
+        {
+            st = move(stashed.back());
+            stashed.pop_back();
+        }
+        else
+            st.reset(new stashed_los);
+    }
+
+    st->place = place;
+    st->radius = get_los_radius();
+    for (rectangle_iterator ri(0); ri; ++ri)
+        st->opacity[ri->x][ri->y] = _cell_opacity(*ri);
+    memcpy(st->los, globallos, sizeof(globallos));
+    stashed.push_front(move(st));
+}
+
+// On arriving at a level, take back what was known about it when it was
+// left, less anything around cells whose opacity has changed since.
+void restore_stashed_los(const level_id &place)
+{
+    for (auto i = stashed.begin(); i != stashed.end(); ++i)
+    {
+        if ((*i)->place != place)
+            continue;
+
+        unique_ptr<stashed_los> st = move(*i);
+        stashed.erase(i);
+        if (st->radius != get_los_radius())
+            return;
+
+        vector<coord_def> changed;
+        for (rectangle_iterator ri(0); ri; ++ri)
+            if (st->opacity[ri->x][ri->y] != _cell_opacity(*ri))
+            {
+                changed.push_back(*ri);
+                if (changed.size() > MAX_STASH_CHANGES)
+                    return;
+            }
+
+        memcpy(globallos, st->los, sizeof(globallos));
+        for (const coord_def &p : changed)
+            invalidate_los_around(p);
+        return;
+    }
+}
+
 static void _update_globallos_at(const coord_def& p, los_type l)
 {
     switch (l)
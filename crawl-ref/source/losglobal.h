@@ -2,7 +2,12 @@
 
 #include "los-type.h"
 
+class level_id;
+
 void invalidate_los_around(const coord_def& p);
 void invalidate_los();
 
+void stash_los(const level_id &place);
+void restore_stashed_los(const level_id &place);
+
 bool cell_see_cell(const coord_def& p, const coord_def& q, los_type l);
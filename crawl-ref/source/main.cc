@@ -297,20 +297,28 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    // Init monsters up front - needed to handle the mon_glyph option right.
-    init_char_table(CSET_ASCII);
-    init_monsters();
+    {
+        startup_phase phase("monster and item data");
+
+        // Init monsters up front - needed to handle the mon_glyph option
+        // right.
+        init_char_table(CSET_ASCII);
+        init_monsters();
 
-    // Init name cache. Currently unused, but item_glyph will need these
-    // once implemented.
-    init_properties();
-    init_item_name_cache();
+        // Init name cache. Currently unused, but item_glyph will need these
+        // once implemented.
+        init_properties();
+        init_item_name_cache();
+    }
 
     // make sure all the expected data directories exist
     validate_basedirs();
 
     // Read the init file.
-    read_init_file();
+    {
+        startup_phase phase("init file");
+        read_init_file();
+    }
 
     // Now parse the args again, looking for everything else.
     parse_args(argc, argv, false);
@@ -330,8 +338,11 @@ int main(int argc, char *argv[])
     }
 
 #ifdef USE_TILE
-    if (!tiles.initialise())
-        return -1;
+    {
+        startup_phase phase("tiles");
+        if (!tiles.initialise())
+            return -1;
+    }
 #endif
 
     _launch_game_loop();
@@ -558,6 +569,7 @@ static void _show_commandline_options_help()
     puts("");
     puts("Miscellaneous options:");
     puts("  -dump-maps       write map Lua to stderr when parsing .des files");
+    puts("  -startup-profile time each phase of startup, print them and exit");
 #ifndef TARGET_OS_WINDOWS
     puts("  -gdb/-no-gdb     produce gdb backtrace when a crash happens (default:on)");
 #endif
@@ -13,6 +13,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
+#include <unordered_map>
 
 #include "abyss.h"
 #include "artefact.h"
@@ -50,6 +51,25 @@
 #include "tiledef-dngn.h"
 #include "tiledef-player.h"
 
+static unordered_map<string, int> _map_tag_ids;
+
+int intern_map_tag(const string &tag)
+{
+    auto found = _map_tag_ids.find(tag);
+    if (found != _map_tag_ids.end())
+        return found->second;
+
+    const int id = _map_tag_ids.size();
+    _map_tag_ids[tag] = id;
+    return id;
+}
+
+int find_map_tag(const string &tag)
+{
+    auto found = _map_tag_ids.find(tag);
+    return found != _map_tag_ids.end() ? found->second : -1;
+}
+
 #ifdef DEBUG_TAG_PROFILING
 static map<string,int> _tag_profile;
 
@@ -2204,9 +2224,12 @@ map_def::map_def()
       validate("dlvalidate"), veto("dlveto"), epilogue("dlepilogue"),
       rock_colour(BLACK), floor_colour(BLACK), rock_tile(""),
       floor_tile(""), border_fill_type(DNGN_ROCK_WALL),
-      tags(),
+      tags(), tag_ids(),
       index_only(false), cache_offset(0L), validating_map_flag(false),
-      cache_minivault(false), cache_overwritable(false), cache_extra(false)
+      cache_minivault(false), cache_overwritable(false), cache_extra(false),
+      cache_dummy(false), cache_tutorial(false), cache_layout(false),
+      cache_nolayout(false), cache_species(false),
+      cache_depth_selectable(false)
 {
     init();
 }
@@ -2975,6 +2998,24 @@ void map_def::update_cached_tags()
     cache_minivault = has_tag("minivault");
     cache_overwritable = has_tag("overwritable");
     cache_extra = has_tag("extra");
+    cache_dummy = has_tag("dummy");
+    cache_tutorial = has_tag_prefix("tutorial");
+    cache_layout = has_tag_prefix("layout_");
+    cache_nolayout = has_tag_prefix("nolayout_");
+    cache_species = has_tag_prefix("no_species_");
+    // Some tagged levels cannot be selected as random maps in a specific
+    // depth.
+    cache_depth_selectable = !has_tag_suffix("entry")
+                             && !has_tag("unrand")
+                             && !has_tag("place_unique")
+                             && !has_tag("tutorial")
+                             && (!has_tag_prefix("temple_")
+                                 || has_tag_prefix("uniq_altar_"));
+
+    tag_ids.clear();
+    for (const string &tag : tags)
+        tag_ids.push_back(intern_map_tag(tag));
+    sort(tag_ids.begin(), tag_ids.end());
 }
 
 bool map_def::is_minivault() const
@@ -3003,6 +3044,40 @@ bool map_def::is_extra_vault() const
     return cache_extra;
 }
 
+bool map_def::is_dummy_vault() const
+{
+#ifdef DEBUG_TAG_PROFILING
+    ASSERT(cache_dummy == has_tag("dummy"));
+#endif
+    return cache_dummy;
+}
+
+// Any tag starting with "tutorial".
+bool map_def::is_tutorial_vault() const
+{
+    return cache_tutorial;
+}
+
+bool map_def::has_layout_tag() const
+{
+    return cache_layout;
+}
+
+bool map_def::has_nolayout_tag() const
+{
+    return cache_nolayout;
+}
+
+bool map_def::has_species_tag() const
+{
+    return cache_species;
+}
+
+bool map_def::tags_allow_depth_selection() const
+{
+    return cache_depth_selectable;
+}
+
 // Tries to dock a floating vault - push it to one edge of the level.
 // Docking will only succeed if two contiguous edges are all x/c/b/v
 // (other walls prevent docking). If the vault's width is > GXM*2/3,
@@ -46,6 +46,11 @@
 void tag_profile_out();
 #endif
 
+// Map tags are interned as small integers, so that maps can be indexed by
+// tag. find_map_tag() returns -1 for a tag no map has had.
+int intern_map_tag(const string &tag);
+int find_map_tag(const string &tag);
+
 class mon_enchant;
 extern const char *traversable_glyphs;
 
@@ -1157,6 +1162,8 @@ public:
 
 private:
     unordered_set<string>     tags;
+    // The interned ids of tags, sorted.
+    vector<int>     tag_ids;
     // This map has been loaded from an index, and not fully realised.
     bool            index_only;
     mutable long    cache_offset;
@@ -1176,6 +1183,14 @@ private:
     bool cache_minivault;
     bool cache_overwritable;
     bool cache_extra;
+    // And these are checked for every map whenever vaults are picked by
+    // place or depth.
+    bool cache_dummy;
+    bool cache_tutorial;
+    bool cache_layout;
+    bool cache_nolayout;
+    bool cache_species;
+    bool cache_depth_selectable;
 
 public:
     map_def();
@@ -1261,6 +1276,13 @@ public:
     bool is_minivault() const;
     bool is_overwritable_layout() const;
     bool is_extra_vault() const;
+    bool is_dummy_vault() const;
+    bool is_tutorial_vault() const;
+    bool has_layout_tag() const;
+    bool has_nolayout_tag() const;
+    bool has_species_tag() const;
+    bool tags_allow_depth_selection() const;
+    const vector<int> &get_tag_ids() const { return tag_ids; }
     bool has_tag(const string &tagwanted) const;
     bool has_tag_prefix(const string &tag) const;
     bool has_tag_suffix(const string &suffix) const;
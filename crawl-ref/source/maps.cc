@@ -67,6 +67,32 @@ point_vector map_anchor_points;
 
 static map_vector vdefs;
 
+typedef vector<unsigned> vault_indices;
+
+// For each interned tag id, the indices into vdefs of the maps with that
+// tag, in ascending order. Rebuilt when vdefs changes.
+static vector<vault_indices> vault_tag_index;
+static bool vault_tag_index_valid = false;
+
+// The maps depth selection could pick on a level: those with a CHANCE there
+// and those without. Whether a map can be used at a depth only changes with
+// vdefs and the branch depths of the game, so each level's candidates are
+// worked out the first time it asks and kept.
+struct depth_candidates
+{
+    vault_indices by_chance;
+    vault_indices by_weight;
+};
+static map<level_id, depth_candidates> vault_depth_index;
+static FixedVector<int, NUM_BRANCHES> vault_depth_index_brdepth;
+static bool vault_depth_index_valid = false;
+
+static void _vdefs_changed()
+{
+    vault_tag_index_valid = false;
+    vault_depth_index_valid = false;
+}
+
 // Parameter array that vault code can use.
 string_vector map_parameters;
 
@@ -672,8 +698,8 @@ static bool _map_matches_layout_type(const map_def &map)
 {
     bool permissive = false;
     if (env.level_layout_types.empty()
-        || (!map.has_tag_prefix("layout_")
-            && !(permissive = map.has_tag_prefix("nolayout_"))))
+        || (!map.has_layout_tag()
+            && !(permissive = map.has_nolayout_tag())))
     {
         return true;
     }
@@ -691,8 +717,11 @@ static bool _map_matches_layout_type(const map_def &map)
 
 static bool _map_matches_species(const map_def &map)
 {
-    if (you.species < 0 || you.species >= NUM_SPECIES)
+    if (you.species < 0 || you.species >= NUM_SPECIES
+        || !map.has_species_tag())
+    {
         return true;
+    }
     return !map.has_tag("no_species_"
            + lowercase_string(get_species_abbrev(you.species)));
 }
@@ -724,18 +753,67 @@ vector<string> find_map_matches(const string &name)
     return matches;
 }
 
+static void _index_vault_tags()
+{
+    vault_tag_index.clear();
+    for (unsigned i = 0, size = vdefs.size(); i < size; ++i)
+        for (int id : vdefs[i].get_tag_ids())
+        {
+            if (id >= (int) vault_tag_index.size())
+                vault_tag_index.resize(id + 1);
+            vault_tag_index[id].push_back(i);
+        }
+
+    vault_tag_index_valid = true;
+}
+
+// The maps with all of the space-separated tags, by intersecting the
+// smallest of their lists with the others.
+static vault_indices _maps_with_tags(const string &tags)
+{
+    if (!vault_tag_index_valid)
+        _index_vault_tags();
+
+    vector<const vault_indices *> lists;
+    for (const string &tag : parse_tags(tags))
+    {
+        const int id = find_map_tag(tag);
+        if (id == -1 || id >= (int) vault_tag_index.size())
+            return vault_indices();
+        lists.push_back(&vault_tag_index[id]);
+    }
+
+    // Like map_def::has_all_tags(), no tags match nothing.
+    if (lists.empty())
+        return vault_indices();
+
+    sort(lists.begin(), lists.end(),
+         [](const vault_indices *a, const vault_indices *b)
+         { return a->size() < b->size(); });
+
+    vault_indices maps = *lists[0];
+    for (unsigned i = 1; i < lists.size() && !maps.empty(); ++i)
+    {
+        vault_indices both;
+        set_intersection(maps.begin(), maps.end(),
+                         lists[i]->begin(), lists[i]->end(),
+                         back_inserter(both));
+        maps.swap(both);
+    }
+    return maps;
+}
+
 mapref_vector find_maps_for_tag(const string &tag,
                                 bool check_depth,
                                 bool check_used)
 {
     mapref_vector maps;
     level_id place = level_id::current();
-    unordered_set<string> tag_set = parse_tags(tag);
 
-    for (const map_def &mapdef : vdefs)
+    for (unsigned i : _maps_with_tags(tag))
     {
-        if (mapdef.has_all_tags(tag_set.begin(), tag_set.end())
-            && !mapdef.has_tag("dummy")
+        const map_def &mapdef = vdefs[i];
+        if (!mapdef.is_dummy_vault()
             && (!check_depth || !mapdef.has_depth()
                 || mapdef.is_usable_in(place))
             && (!check_used || !mapdef.map_already_used()))
@@ -748,7 +826,7 @@ mapref_vector find_maps_for_tag(const string &tag,
 
 struct map_selector
 {
-private:
+public:
     enum select_type
     {
         PLACE,
@@ -757,7 +835,6 @@ private:
         TAG,
     };
 
-public:
     bool accept(const map_def &md) const;
     void announce(const map_def *map) const;
 
@@ -829,15 +906,10 @@ public:
 
 bool map_selector::depth_selectable(const map_def &mapdef) const
 {
-    return mapdef.is_usable_in(place)
-           // Some tagged levels cannot be selected as random
-           // maps in a specific depth:
-           && !mapdef.has_tag_suffix("entry")
-           && !mapdef.has_tag("unrand")
-           && !mapdef.has_tag("place_unique")
-           && !mapdef.has_tag("tutorial")
-           && (!mapdef.has_tag_prefix("temple_")
-               || mapdef.has_tag_prefix("uniq_altar_"))
+    // Some tagged levels cannot be selected as random maps in a specific
+    // depth; check that first since it is cheap.
+    return mapdef.tags_allow_depth_selection()
+           && mapdef.is_usable_in(place)
            && _map_matches_species(mapdef)
            && (!check_layout || _map_matches_layout_type(mapdef));
 }
@@ -854,7 +926,7 @@ bool map_selector::accept(const map_def &mapdef) const
     switch (sel)
     {
     case PLACE:
-        if (mapdef.has_tag_prefix("tutorial")
+        if (mapdef.is_tutorial_vault()
             && (!crawl_state.game_is_tutorial()
                 || !mapdef.has_tag(crawl_state.map)))
         {
@@ -871,7 +943,7 @@ bool map_selector::accept(const map_def &mapdef) const
         const map_chance chance(mapdef.chance(place));
         return mapdef.is_minivault() == mini
                && _is_extra_compatible(extra, mapdef.is_extra_vault())
-               && (!chance.valid() || mapdef.has_tag("dummy"))
+               && (!chance.valid() || mapdef.is_dummy_vault())
                && depth_selectable(mapdef)
                && !mapdef.map_already_used();
     }
@@ -881,7 +953,7 @@ bool map_selector::accept(const map_def &mapdef) const
         const map_chance chance(mapdef.chance(place));
         // Only vaults with valid chance
         return chance.valid()
-               && !mapdef.has_tag("dummy")
+               && !mapdef.is_dummy_vault()
                && depth_selectable(mapdef)
                && _is_extra_compatible(extra, mapdef.is_extra_vault())
                && !mapdef.map_already_used();
@@ -941,17 +1013,77 @@ string vault_chance_tag(const map_def &map)
     return "";
 }
 
-typedef vector<unsigned> vault_indices;
+static const depth_candidates &_depth_candidates(const level_id &place)
+{
+    bool same_depths = vault_depth_index_valid;
+    for (int i = 0; i < NUM_BRANCHES && same_depths; ++i)
+        same_depths = vault_depth_index_brdepth[i] == brdepth[i];
+
+    if (!same_depths)
+    {
+        vault_depth_index.clear();
+        vault_depth_index_brdepth = brdepth;
+        vault_depth_index_valid = true;
+    }
+
+    auto found = vault_depth_index.find(place);
+    if (found != vault_depth_index.end())
+        return found->second;
+
+    depth_candidates &cands = vault_depth_index[place];
+    for (unsigned i = 0, size = vdefs.size(); i < size; ++i)
+    {
+        const map_def &mapdef = vdefs[i];
+        if (!mapdef.tags_allow_depth_selection()
+            || !mapdef.is_usable_in(place))
+        {
+            continue;
+        }
+
+        const bool chance = mapdef.chance(place).valid();
+        if (chance && !mapdef.is_dummy_vault())
+            cands.by_chance.push_back(i);
+        if (!chance || mapdef.is_dummy_vault())
+            cands.by_weight.push_back(i);
+    }
+    return cands;
+}
 
+// Narrow the maps down as cheaply as the selector allows; the selector
+// itself has the final say.
 static vault_indices _eligible_maps_for_selector(const map_selector &sel)
 {
     vault_indices eligible;
 
-    if (sel.valid())
+    if (!sel.valid())
+        return eligible;
+
+    auto add_accepted = [&](const vault_indices &maps)
+    {
+        for (unsigned i : maps)
+            if (sel.accept(vdefs[i]))
+                eligible.push_back(i);
+    };
+
+    switch (sel.sel)
     {
+    case map_selector::DEPTH:
+        add_accepted(_depth_candidates(sel.place).by_weight);
+        break;
+
+    case map_selector::DEPTH_AND_CHANCE:
+        add_accepted(_depth_candidates(sel.place).by_chance);
+        break;
+
+    case map_selector::TAG:
+        add_accepted(_maps_with_tags(sel.tag));
+        break;
+
+    default:
         for (unsigned i = 0, size = vdefs.size(); i < size; ++i)
             if (sel.accept(vdefs[i]))
                 eligible.push_back(i);
+        break;
     }
 
     return eligible;
@@ -1120,7 +1252,7 @@ _random_map_in_list(const map_selector &sel,
     }
 
     if (!sel.preserve_dummy && chosen_map
-        && chosen_map->has_tag("dummy"))
+        && chosen_map->is_dummy_vault())
     {
         chosen_map = nullptr;
     }
@@ -1227,19 +1359,25 @@ string get_descache_path(const string &file, const string &ext)
     return _des_cache_dir(basename);
 }
 
-static bool verify_file_version(const string &file, time_t mtime)
+// Every des cache file starts with this header; mtime is that of the source
+// the cache was built from.
+void write_descache_header(writer &outf, time_t mtime)
+{
+    marshallUByte(outf, TAG_MAJOR_VERSION);
+    marshallUByte(outf, TAG_MINOR_VERSION);
+    marshallByte(outf, WORD_LEN);
+    marshallSigned(outf, mtime);
+}
+
+// Checks the header written by write_descache_header().
+bool verify_descache_header(reader &inf, time_t mtime)
 {
-    FILE *fp = fopen_u(file.c_str(), "rb");
-    if (!fp)
-        return false;
     try
     {
-        reader inf(fp);
         const uint8_t major = unmarshallUByte(inf);
         const uint8_t minor = unmarshallUByte(inf);
         const int8_t word = unmarshallByte(inf);
         const int64_t t = unmarshallSigned(inf);
-        fclose(fp);
         return major == TAG_MAJOR_VERSION
                && minor <= TAG_MINOR_VERSION
                && word == WORD_LEN
@@ -1247,11 +1385,21 @@ static bool verify_file_version(const string &file, time_t mtime)
     }
     catch (short_read_exception &E)
     {
-        fclose(fp);
         return false;
     }
 }
 
+static bool verify_file_version(const string &file, time_t mtime)
+{
+    FILE *fp = fopen_u(file.c_str(), "rb");
+    if (!fp)
+        return false;
+    reader inf(fp);
+    const bool ok = verify_descache_header(inf, mtime);
+    fclose(fp);
+    return ok;
+}
+
 static bool _verify_map_index(const string &base, time_t mtime)
 {
     return verify_file_version(base + ".idx", mtime);
@@ -1310,6 +1458,7 @@ static bool _load_map_index(const string& cache, const string &base,
     const int nmaps = unmarshallShort(inf);
     const int nexist = vdefs.size();
     vdefs.resize(nexist + nmaps, map_def());
+    _vdefs_changed();
     for (int i = 0; i < nmaps; ++i)
     {
         map_def &vdef(vdefs[nexist + i]);
@@ -1358,10 +1507,7 @@ static void _write_map_prelude(const string &filebase, time_t mtime)
 
     FILE *fp = fopen_u(luafile.c_str(), "wb");
     writer outf(luafile, fp);
-    marshallUByte(outf, TAG_MAJOR_VERSION);
-    marshallUByte(outf, TAG_MINOR_VERSION);
-    marshallByte(outf, WORD_LEN);
-    marshallSigned(outf, mtime);
+    write_descache_header(outf, mtime);
     lc_global_prelude.write(outf);
     fclose(fp);
 }
@@ -1375,10 +1521,7 @@ static void _write_map_full(const string &filebase, size_t vs, size_t ve,
         end(1, true, "Unable to open %s for writing", cfile.c_str());
 
     writer outf(cfile, fp);
-    marshallUByte(outf, TAG_MAJOR_VERSION);
-    marshallUByte(outf, TAG_MINOR_VERSION);
-    marshallByte(outf, WORD_LEN);
-    marshallSigned(outf, mtime);
+    write_descache_header(outf, mtime);
     for (size_t i = vs; i < ve; ++i)
         vdefs[i].write_full(outf);
     fclose(fp);
@@ -1393,10 +1536,7 @@ static void _write_map_index(const string &filebase, size_t vs, size_t ve,
         end(1, true, "Unable to open %s for writing", cfile.c_str());
 
     writer outf(cfile, fp);
-    marshallUByte(outf, TAG_MAJOR_VERSION);
-    marshallUByte(outf, TAG_MINOR_VERSION);
-    marshallByte(outf, WORD_LEN);
-    marshallSigned(outf, mtime);
+    write_descache_header(outf, mtime);
     marshallShort(outf, ve > vs? ve - vs : 0);
     for (size_t i = vs; i < ve; ++i)
     {
@@ -1496,6 +1636,7 @@ void reread_maps()
 
     // BOOM!
     vdefs.clear();
+    _vdefs_changed();
     map_files_read.clear();
     read_maps();
 }
@@ -1515,6 +1656,7 @@ void add_parsed_map(const map_def &md)
 
     map.fixup();
     vdefs.push_back(map);
+    _vdefs_changed();
 }
 
 void run_map_global_preludes()
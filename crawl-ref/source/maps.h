@@ -59,6 +59,8 @@ void read_map(const string &file);
 void run_map_global_preludes();
 void run_map_local_preludes();
 string get_descache_path(const string &file, const string &ext);
+void write_descache_header(writer &outf, time_t mtime);
+bool verify_descache_header(reader &inf, time_t mtime);
 
 typedef map<string, map_file_place> map_load_info_t;
 
@@ -215,6 +215,32 @@ bool try_pathfind(monster* mon)
         return false;
     }
 
+    // When the target is the player, the shared distance field can rule out
+    // a path without a search of our own, and usually gives one outright.
+    if (foe->is_player())
+    {
+        const int bound = player_distance_bound(mon);
+        if (bound == INFINITE_DISTANCE || range > 0 && bound > range * 2)
+        {
+            _set_no_path_found(mon);
+            return false;
+        }
+
+        if (bound >= 0)
+        {
+            monster_pathfind mp;
+            if (range > 0)
+                mp.set_range(range);
+            mon->travel_path = mp.follow_player_field(mon);
+            if (!mon->travel_path.empty())
+            {
+                mon->target = mon->travel_path[0];
+                mon->travel_target = MTRAV_FOE;
+                return true;
+            }
+        }
+    }
+
 #ifdef DEBUG_PATHFIND
     mprf("Need a path for %s from (%d, %d) to (%d, %d), max. dist = %d",
          mon->name(DESC_PLAIN).c_str(), mon->pos().x, mon->pos().y,
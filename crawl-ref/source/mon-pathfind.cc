@@ -2,11 +2,13 @@
 
 #include "mon-pathfind.h"
 
+#include "coordit.h"
 #include "directn.h"
 #include "env.h"
 #include "los.h"
 #include "mon-movetarget.h"
 #include "mon-place.h"
+#include "mon-util.h"
 #include "religion.h"
 #include "state.h"
 #include "terrain.h"
@@ -18,16 +20,69 @@
 // The pathfinding is an implementation of the A* algorithm. Beginning at the
 // monster position we check all neighbours of a given grid, estimate the
 // distance needed for any shortest path including this grid and push the
-// result into a hash. We can then easily access all points with the shortest
-// distance estimates and then check _their_ neighbours and so on.
+// result onto a heap. We can then easily access the point with the shortest
+// distance estimate and then check _its_ neighbours and so on.
 // The algorithm terminates once we reach the destination since - because
-// of the sorting of grids by shortest distance in the hash - there can be no
+// of the ordering of grids by shortest distance in the heap - there can be no
 // path between start and target that is shorter than the current one. There
 // could be other paths that have the same length but that has no real impact.
-// If the hash has been cleared and the start grid has not been encountered,
+// If the heap has been emptied and the start grid has not been encountered,
 // then there's no path that matches the requirements fed into monster_pathfind.
 // (These requirements are usually preference of habitat of a specific monster
 // or a limit of the distance between start and any grid on the path.)
+//
+// Among grids with the same estimate, the one pushed last is expanded first,
+// and a grid whose distance improves counts as pushed anew. The paths found,
+// and so the random rotations rolled while finding them, depend on this order.
+
+struct pathfind_node
+{
+    int total;
+    unsigned int seq;
+    coord_def pos;
+
+    // std::push_heap builds a max-heap, so the "largest" node is the one with
+    // the lowest estimate, ties going to the most recently pushed.
+    bool operator<(const pathfind_node &other) const
+    {
+        if (total != other.total)
+            return total > other.total;
+        return seq < other.seq;
+    }
+};
+
+// Rather than clearing dist for every search, each search gets a new
+// generation, and a distance only counts if it was stamped in the current
+// one. prev is only ever read along paths found in the current search.
+struct pathfind_grid
+{
+    unsigned int generation;
+    unsigned int seq;
+    unsigned int stamp[GXM][GYM];
+    // The array of distances from start to any already tried point.
+    int dist[GXM][GYM];
+    // An array to store where we came from on a given shortest path.
+    int prev[GXM][GYM];
+    vector<pathfind_node> open;
+
+    pathfind_grid() : generation(0), seq(0), stamp(), dist(), prev(), open()
+    {
+    }
+
+    void new_search()
+    {
+        open.clear();
+        seq = 0;
+        if (++generation == 0)
+        {
+            memset(stamp, 0, sizeof(stamp));
+            generation = 1;
+        }
+    }
+};
+
+static pathfind_grid shared_grid;
+static bool shared_grid_in_use = false;
 
 int mons_tracking_range(const monster* mon)
 {
@@ -64,16 +119,197 @@ int mons_tracking_range(const monster* mon)
     return range;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// Distance fields towards the player.
+//
+// Most monsters that need to pathfind are after the player, and when there is
+// no path at all, A* only gives up after it has exhausted everything the
+// monster could reach. Instead, for each movement class we keep a breadth
+// first distance field from the player, built at most once per player turn,
+// over every cell any monster of that class could possibly pass (closed doors
+// included, other monsters and traps ignored). A monster's real path is never
+// shorter than its field distance, so a cell the field never reached, or
+// reached only beyond the pathfinding budget, cannot have a path either.
+// Where the monster can take every step of a shortest field path at unit
+// cost, following the field downhill gives it an optimal path with no
+// search at all (see monster_pathfind::follow_player_field).
+
+enum movement_class
+{
+    MOVE_NONE = -1,
+    MOVE_WALK,
+    MOVE_SWIM,
+    MOVE_AMPHIBIOUS,
+    MOVE_LAVA,
+    MOVE_AMPHIBIOUS_LAVA,
+    MOVE_FLY,
+    NUM_MOVEMENT_CLASSES
+};
+
+struct player_distance_field
+{
+    bool valid;
+    int elapsed_time;
+    coord_def source;
+    level_id place;
+    unsigned short dist[GXM][GYM];
+};
+
+static player_distance_field player_fields[NUM_MOVEMENT_CLASSES];
+
+static movement_class _movement_class(const monster* mon)
+{
+    // Wall clingers, and the monsters monster_pathfind makes exceptions for,
+    // can pass cells the habitat rules below don't know about.
+    if (mon->can_cling_to_walls()
+        || mon->type == MONS_THORN_HUNTER
+        || mon->type == MONS_WANDERING_MUSHROOM
+        || mon->type == MONS_ELDRITCH_TENTACLE
+        || mon->type == MONS_ELDRITCH_TENTACLE_SEGMENT)
+    {
+        return MOVE_NONE;
+    }
+
+    const monster_type mt = fixup_zombie_type(mon->type,
+                                              mons_base_type(*mon));
+    if (mon->airborne() || mons_class_flag(mt, M_FLIES))
+        return MOVE_FLY;
+
+    switch (mons_habitat(*mon))
+    {
+    case HT_LAND:             return MOVE_WALK;
+    case HT_WATER:            return MOVE_SWIM;
+    case HT_AMPHIBIOUS:       return MOVE_AMPHIBIOUS;
+    case HT_LAVA:             return MOVE_LAVA;
+    case HT_AMPHIBIOUS_LAVA:  return MOVE_AMPHIBIOUS_LAVA;
+    default:                  return MOVE_NONE;
+    }
+}
+
+// Could some monster of this class pass through the given feature?
+static bool _class_passable(movement_class mc, dungeon_feature_type feat)
+{
+    if (feat_is_closed_door(feat))
+        return true;
+    if (feat_is_solid(feat))
+        return false;
+
+    const bool land  = feat_has_solid_floor(feat);
+    const bool water = feat_is_watery(feat);
+    const bool lava  = feat == DNGN_LAVA;
+
+    switch (mc)
+    {
+    case MOVE_WALK:             return land;
+    case MOVE_SWIM:             return water;
+    case MOVE_AMPHIBIOUS:       return land || water;
+    case MOVE_LAVA:             return lava;
+    case MOVE_AMPHIBIOUS_LAVA:  return land || lava;
+    case MOVE_FLY:              return true;
+    default:                    return false;
+    }
+}
+
+static void _build_player_field(player_distance_field &field,
+                                movement_class mc)
+{
+    field.valid        = true;
+    field.elapsed_time = you.elapsed_time;
+    field.source       = you.pos();
+    field.place        = level_id::current();
+
+    for (int x = 0; x < GXM; ++x)
+        for (int y = 0; y < GYM; ++y)
+            field.dist[x][y] = INFINITE_DISTANCE;
+
+    // As in monster_pathfind, the cells at either end need not be passable
+    // themselves: every neighbour of an expanded cell gets a distance, but
+    // only passable ones are expanded in turn.
+    vector<coord_def> current, next;
+    field.dist[field.source.x][field.source.y] = 0;
+    current.push_back(field.source);
+    for (int d = 1; !current.empty(); ++d)
+    {
+        for (const coord_def c : current)
+            for (adjacent_iterator ai(c); ai; ++ai)
+            {
+                if (!in_bounds(*ai)
+                    || field.dist[ai->x][ai->y] != INFINITE_DISTANCE)
+                {
+                    continue;
+                }
+                field.dist[ai->x][ai->y] = d;
+                if (_class_passable(mc, grd(*ai)))
+                    next.push_back(*ai);
+            }
+        current.swap(next);
+        next.clear();
+    }
+}
+
+// The up to date field for the monster's movement class, if it has one.
+static const player_distance_field *_player_field(const monster* mon)
+{
+    const movement_class mc = _movement_class(mon);
+    if (mc == MOVE_NONE)
+        return nullptr;
+
+    player_distance_field &field = player_fields[mc];
+    if (!field.valid
+        || field.elapsed_time != you.elapsed_time
+        || field.source != you.pos()
+        || field.place != level_id::current())
+    {
+        _build_player_field(field, mc);
+    }
+    return &field;
+}
+
+/**
+ * A lower bound on the length of any path the monster could take to the
+ * player.
+ *
+ * @param mon   the monster looking for a path.
+ * @returns     the bound; INFINITE_DISTANCE if no path can exist; or -1 if
+ *              the monster moves in ways the distance fields don't model.
+ */
+int player_distance_bound(const monster* mon)
+{
+    const player_distance_field *field = _player_field(mon);
+    if (!field)
+        return -1;
+    return field->dist[mon->pos().x][mon->pos().y];
+}
+
+void invalidate_player_distance_fields()
+{
+    for (player_distance_field &field : player_fields)
+        field.valid = false;
+}
+
 //#define DEBUG_PATHFIND
 monster_pathfind::monster_pathfind()
     : mons(nullptr), start(), target(), pos(), allow_diagonals(true),
-      traverse_unmapped(false), range(0), min_length(0), max_length(0),
-      dist(), prev(), hash()
+      traverse_unmapped(false), range(0), grid(nullptr), owns_grid(false)
 {
+    if (shared_grid_in_use)
+    {
+        grid = new pathfind_grid;
+        owns_grid = true;
+    }
+    else
+    {
+        grid = &shared_grid;
+        shared_grid_in_use = true;
+    }
 }
 
 monster_pathfind::~monster_pathfind()
 {
+    if (owns_grid)
+        delete grid;
+    else
+        shared_grid_in_use = false;
 }
 
 void monster_pathfind::set_range(int r)
@@ -84,7 +320,7 @@ void monster_pathfind::set_range(int r)
 
 coord_def monster_pathfind::next_pos(const coord_def &c) const
 {
-    return c + Compass[prev[c.x][c.y]];
+    return c + Compass[grid->prev[c.x][c.y]];
 }
 
 // The main method in the monster_pathfind class.
@@ -139,18 +375,15 @@ bool monster_pathfind::start_pathfind(bool msg)
     //       surrounded by shallow water or floor, or if a foe is hiding in
     //       a wall.
 
-    max_length = min_length = grid_distance(pos, target);
-    for (int i = 0; i < GXM; i++)
-        for (int j = 0; j < GYM; j++)
-            dist[i][j] = INFINITE_DISTANCE;
-
-    dist[pos.x][pos.y] = 0;
+    grid->new_search();
+    grid->stamp[pos.x][pos.y] = grid->generation;
+    grid->dist[pos.x][pos.y] = 0;
 
     bool success = false;
     do
     {
         // Calculate the distance to all neighbours of the current position,
-        // and add them to the hash, if they haven't already been looked at.
+        // and add them to the heap, if they haven't already been looked at.
         success = calc_path_to_neighbours();
         if (success)
             return true;
@@ -214,8 +447,8 @@ bool monster_pathfind::calc_path_to_neighbours()
         if (range && estimated_cost(npos) > range)
             continue;
 
-        distance = dist[pos.x][pos.y] + travel_cost(npos);
-        old_dist = dist[npos.x][npos.y];
+        distance = grid->dist[pos.x][pos.y] + travel_cost(npos);
+        old_dist = get_dist(npos);
 
         // Also bail out if this would make the path longer than twice the
         // allowed distance from the target. (This factor may need tuning.)
@@ -239,12 +472,10 @@ bool monster_pathfind::calc_path_to_neighbours()
             if (old_dist == INFINITE_DISTANCE)
             {
 #ifdef DEBUG_PATHFIND
-                mprf("Adding (%d,%d) to hash (total dist = %d)",
+                mprf("Adding (%d,%d) to heap (total dist = %d)",
                      npos.x, npos.y, total);
 #endif
                 add_new_pos(npos, total);
-                if (total > max_length)
-                    max_length = total;
             }
             else
             {
@@ -257,7 +488,8 @@ bool monster_pathfind::calc_path_to_neighbours()
             }
 
             // Update distance start->pos.
-            dist[npos.x][npos.y] = distance;
+            grid->stamp[npos.x][npos.y] = grid->generation;
+            grid->dist[npos.x][npos.y] = distance;
 
             // Set backtracking information.
             // Converts the Compass direction to its counterpart.
@@ -265,7 +497,7 @@ bool monster_pathfind::calc_path_to_neighbours()
             //      7  .  3   ==>   3  .  7       e.g. (3 + 4) % 8          = 7
             //      6  5  4         2  1  0            (7 + 4) % 8 = 11 % 8 = 3
 
-            prev[npos.x][npos.y] = (dir + 4) % 8;
+            grid->prev[npos.x][npos.y] = (dir + 4) % 8;
 
             // Are we finished?
             if (npos == target)
@@ -280,34 +512,28 @@ bool monster_pathfind::calc_path_to_neighbours()
     return false;
 }
 
-// Starting at known min_length (minimum total estimated path distance), check
-// the hash for existing vectors, then pick the last entry of the first vector
-// that matches. Update min_length, if necessary.
+// Pop the position with the lowest total estimated path distance, skipping
+// entries left behind by grids whose distance has since improved.
 bool monster_pathfind::get_best_position()
 {
-    for (int i = min_length; i <= max_length; i++)
+    vector<pathfind_node> &open = grid->open;
+    while (!open.empty())
     {
-        if (!hash[i].empty())
-        {
-            if (i > min_length)
-                min_length = i;
+        pop_heap(open.begin(), open.end());
+        const pathfind_node node = open.back();
+        open.pop_back();
 
-            vector<coord_def> &vec = hash[i];
-            // Pick the last position pushed into the vector as it's most
-            // likely to be close to the target.
-            pos = vec[vec.size()-1];
-            vec.pop_back();
+        if (get_dist(node.pos) + estimated_cost(node.pos) != node.total)
+            continue;
 
-#ifdef DEBUG_PATHFIND
-            mprf("Returning (%d, %d) as best pos with total dist %d.",
-                 pos.x, pos.y, min_length);
-#endif
+        pos = node.pos;
 
-            return true;
-        }
 #ifdef DEBUG_PATHFIND
-        mprf("No positions for path length %d.", i);
+        mprf("Returning (%d, %d) as best pos with total dist %d.",
+             pos.x, pos.y, node.total);
 #endif
+
+        return true;
     }
 
     // Nothing found? Then there's no path! :(
@@ -331,7 +557,7 @@ vector<coord_def> monster_pathfind::backtrack()
     int dir;
     do
     {
-        dir = prev[pos.x][pos.y];
+        dir = grid->prev[pos.x][pos.y];
         pos = pos + Compass[dir];
         ASSERT_IN_BOUNDS(pos);
 #ifdef DEBUG_PATHFIND
@@ -349,6 +575,64 @@ vector<coord_def> monster_pathfind::backtrack()
     return path;
 }
 
+/**
+ * Find a path to the player by stepping down the player distance field.
+ *
+ * Each step goes to a neighbour one closer in the field, picked at random
+ * among those the monster can enter at the lowest travel cost. A path made
+ * of such steps is as short as the field allows, so no search could find a
+ * cheaper one. If some step has no such neighbour (a door to open, water to
+ * flounder through, a trap to avoid, a cell the monster can't enter), this
+ * gives up and the caller falls back to a search.
+ *
+ * @param mon   the monster looking for a path.
+ * @returns     the path's waypoints, as calc_waypoints() gives them;
+ *              empty if the field couldn't be followed all the way.
+ */
+vector<coord_def> monster_pathfind::follow_player_field(const monster* mon)
+{
+    const player_distance_field *field = _player_field(mon);
+    if (!field)
+        return {};
+
+    mons   = mon;
+    start  = mon->pos();
+    target = you.pos();
+    pos    = start;
+    allow_diagonals   = true;
+    traverse_unmapped = false;
+    traverse_in_sight = (!crawl_state.game_is_arena()
+                         && mon->friendly() && mon->is_summoned()
+                         && you.see_cell_no_trans(mon->pos()));
+
+    int d = field->dist[start.x][start.y];
+    if (d == INFINITE_DISTANCE || range > 0 && d > range * 2)
+        return {};
+
+    vector<coord_def> path;
+    path.push_back(start);
+    for (; d > 0; --d)
+    {
+        coord_def next;
+        int count = 0;
+        for (adjacent_iterator ai(pos); ai; ++ai)
+        {
+            if (field->dist[ai->x][ai->y] != d - 1)
+                continue;
+            if (*ai != target && (!traversable(*ai) || travel_cost(*ai) != 1))
+                continue;
+            if (one_chance_in(++count))
+                next = *ai;
+        }
+        if (!count)
+            return {};
+        pos = next;
+        path.push_back(pos);
+    }
+
+    return waypoints_for(path);
+}
+
 // Reduces the path coordinates to only a couple of key waypoints needed
 // to reach the target. Waypoints are chosen such that from one waypoint you
 // can see (and, more importantly, reach) the next one. Note that
@@ -358,8 +642,11 @@ vector<coord_def> monster_pathfind::backtrack()
 // avoid plants and other monsters in the way.
 vector<coord_def> monster_pathfind::calc_waypoints()
 {
-    vector<coord_def> path = backtrack();
+    return waypoints_for(backtrack());
+}
 
+vector<coord_def> monster_pathfind::waypoints_for(const vector<coord_def> &path)
+{
     // If no path found, nothing to be done.
     if (path.empty())
         return path;
@@ -498,26 +785,22 @@ int monster_pathfind::estimated_cost(coord_def p)
     return grid_distance(p, target);
 }
 
+int monster_pathfind::get_dist(const coord_def& p) const
+{
+    if (grid->stamp[p.x][p.y] != grid->generation)
+        return INFINITE_DISTANCE;
+    return grid->dist[p.x][p.y];
+}
+
 void monster_pathfind::add_new_pos(coord_def npos, int total)
 {
-    hash[total].push_back(npos);
+    grid->open.push_back({total, grid->seq++, npos});
+    push_heap(grid->open.begin(), grid->open.end());
 }
 
+// The entry for the old distance stays in the heap and is dropped when it
+// surfaces, since it no longer matches the grid's distance.
 void monster_pathfind::update_pos(coord_def npos, int total)
 {
-    // Find hash position of old distance and delete it,
-    // then call_add_new_pos.
-    int old_total = dist[npos.x][npos.y] + estimated_cost(npos);
-
-    vector<coord_def> &vec = hash[old_total];
-    for (unsigned int i = 0; i < vec.size(); i++)
-    {
-        if (vec[i] == npos)
-        {
-            vec.erase(vec.begin() + i);
-            break;
-        }
-    }
-
     add_new_pos(npos, total);
 }
@@ -1,14 +1,19 @@
 #pragma once
 
 class monster;
+struct pathfind_grid;
 
 int mons_tracking_range(const monster* mon);
 
+int player_distance_bound(const monster* mon);
+void invalidate_player_distance_fields();
+
 class monster_pathfind
 {
 public:
     monster_pathfind();
     virtual ~monster_pathfind();
+    DISALLOW_COPY_AND_ASSIGN(monster_pathfind);
 
     // public methods
     void set_range(int r);
@@ -21,15 +26,18 @@ public:
     bool start_pathfind(bool msg = false);
     vector<coord_def> backtrack();
     vector<coord_def> calc_waypoints();
+    vector<coord_def> follow_player_field(const monster* mon);
 
 protected:
     // protected methods
+    vector<coord_def> waypoints_for(const vector<coord_def> &path);
     bool calc_path_to_neighbours();
     bool traversable(const coord_def& p);
     int  travel_cost(coord_def npos);
     bool mons_traversable(const coord_def& p);
     int  mons_travel_cost(coord_def npos);
     int  estimated_cost(coord_def npos);
+    int  get_dist(const coord_def& p) const;
     void add_new_pos(coord_def pos, int total);
     void update_pos(coord_def pos, int total);
     bool get_best_position();
@@ -55,14 +63,9 @@ protected:
     // Maximum range to search between start and target. None, if zero.
     int range;
 
-    // Currently shortest and longest possible total length of the path.
-    int min_length;
-    int max_length;
-
-    // The array of distances from start to any already tried point.
-    int dist[GXM][GYM];
-    // An array to store where we came from on a given shortest path.
-    int prev[GXM][GYM];
-
-    FixedVector<vector<coord_def>, GXM * GYM> hash;
+    // Distances, backtracking information and the open list. Normally the
+    // one grid shared by all pathfinders; a private one is allocated only if
+    // the shared grid is still held by another live instance.
+    pathfind_grid *grid;
+    bool owns_grid;
 };
@@ -12,6 +12,7 @@
 #include <functional>
 
 #include "abyss.h"
+#include "act-iter.h"
 #include "areas.h"
 #include "arena.h"
 #include "attitude-change.h"
@@ -874,14 +875,14 @@ monster* place_monster(mgen_data mg, bool force_pos, bool dont_place)
 
 monster* get_free_monster()
 {
-    for (auto &mons : menv_real)
-        if (mons.type == MONS_NO_MONSTER)
-        {
-            mons.reset();
-            return &mons;
-        }
+    const int i = free_monster_slot();
+    if (i == NON_MONSTER)
+        return nullptr;
 
-    return nullptr;
+    monster &mons = menv[i];
+    mons.reset();
+    monster_slot_taken(mons);
+    return &mons;
 }
 
 void mons_add_blame(monster* mon, const string &blame_string)
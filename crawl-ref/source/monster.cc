@@ -151,6 +151,8 @@ void monster::reset()
     mons_remove_from_grid(*this);
     target.reset();
     position.reset();
+    monster_index_moved(*this);
+    monster_slot_freed(*this);
     firing_pos.reset();
     patrol_point.reset();
     travel_target = MTRAV_NONE;
@@ -183,6 +185,7 @@ void monster::init_with(const monster& mon)
     speed             = mon.speed;
     speed_increment   = mon.speed_increment;
     position          = mon.position;
+    monster_index_moved(*this);
     target            = mon.target;
     firing_pos        = mon.firing_pos;
     patrol_point      = mon.patrol_point;
@@ -211,6 +214,9 @@ void monster::init_with(const monster& mon)
         ghost.reset(new ghost_demon(*mon.ghost));
     else
         ghost.reset(nullptr);
+
+    if (type != MONS_NO_MONSTER)
+        monster_slot_taken(*this);
 }
 
 uint32_t monster::last_client_id = 0;
@@ -669,4 +669,7 @@ static void _setup_generic(const newgame_def& ng)
     else
         you.save = new package(get_savedir_filename(you.your_name).c_str(),
                                true, true);
+    you.save->set_compression(
+        static_cast<save_compression_type>(Options.save_compression));
+    you.save->set_background_writes(Options.background_save);
 }
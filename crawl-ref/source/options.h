@@ -398,6 +398,8 @@ public:
     vector<menu_sort_condition> sort_menus;
 
     bool        dump_on_save;       // Automatically dump character when saving.
+    bool        background_save;    // Write save chunks on a worker thread.
+    int         save_compression;   // save_compression_type for new saves.
     int         dump_kill_places;   // How to dump place information for kills.
     int         dump_message_count; // How many old messages to dump
 
@@ -584,6 +586,7 @@ public:
     bool        tile_level_map_hide_messages;
     bool        tile_level_map_hide_sidebar;
     bool        tile_web_mouse_control;
+    int         tile_web_frame_rate;
 #endif
 #endif // USE_TILE
 
@@ -1539,8 +1539,22 @@ static void _redraw_title()
     textcolour(LIGHTGREY);
 }
 
+static unsigned int _hud_generation = 1;
+
+/**
+ * How many times the HUD has been brought up to date. Anything the HUD shows
+ * can only be assumed unchanged while this stays the same; webtiles uses it
+ * to skip re-examining the player on redraws in between.
+ */
+unsigned int hud_generation()
+{
+    return _hud_generation;
+}
+
 void print_stats()
 {
+    _hud_generation++;
+
     int temp = (you.species == SP_LAVA_ORC) ? 1 : 0;
     int temp_pos = 5;
     int ac_pos = temp_pos + temp;
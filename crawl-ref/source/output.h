@@ -14,6 +14,7 @@ void reset_hud();
 void update_turn_count();
 
 void print_stats();
+unsigned int hud_generation();
 void print_stats_level();
 void draw_border();
 
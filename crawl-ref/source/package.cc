@@ -16,6 +16,10 @@ Notes:
 * Readers always get the last complete (but not necessarily committed) write
   (ie, READ_UNCOMMITTED) at the time they started; it is safe to continue
   reading even if the chunk has been changed since.
+* With background writes enabled, chunks and commits are queued and carried
+  out in order by a worker thread. A crash may lose queued work, but the
+  save still returns to the state of the last commit that was carried out.
+  Reading, replacing or deleting a chunk first waits for its queued writes.
 */
 
 #include "AppHdr.h"
@@ -25,6 +29,8 @@ Notes:
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <exception>
 #include <sstream>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -36,6 +42,7 @@ Notes:
 #include "errors.h"
 #include "syscalls.h"
 #include "libutil.h" // map_find
+#include "threads.h"
 
 // debugging defines
 #undef  FSCK_VERBOSE
@@ -57,14 +64,18 @@ static plen_t htole(plen_t x)
 #define dprintf(...) do {} while (0)
 #endif
 
+// Version 2 has the same layout as 1, and marks packages using a codec
+// other than zlib so that older versions refuse to load them.
 #define PACKAGE_VERSION 1
+#define PACKAGE_VERSION_CODEC 2
 #define PACKAGE_MAGIC   0x53534344 /* "DCSS" */
 
 struct file_header
 {
     uint32_t magic;
     uint8_t version;
-    char padding[3];
+    uint8_t codec;
+    char padding[2];
     plen_t start;
 };
 
@@ -74,6 +85,46 @@ struct block_header
     plen_t next;
 };
 
+// A chunk (or, with no name, a commit) waiting for the background writer.
+struct package_job
+{
+    bool commit;
+    string name;
+    vector<unsigned char> data;
+};
+
+struct package_worker
+{
+    thread_t thread;
+    // Guards all of the package's state while the worker is running.
+    mutex_t lock;
+    cond_t work_ready;
+    cond_t work_done;
+    // The front job stays queued while it is being carried out.
+    deque<package_job> jobs;
+    bool stopping;
+    // An error thrown on the worker, to be rethrown on the main thread.
+    exception_ptr error;
+};
+
+// Holds the worker's lock, if there is a worker.
+class package_lock
+{
+public:
+    package_lock(package_worker *w) : worker(w)
+    {
+        if (worker)
+            mutex_lock(worker->lock);
+    }
+    ~package_lock()
+    {
+        if (worker)
+            mutex_unlock(worker->lock);
+    }
+private:
+    package_worker *worker;
+};
+
 typedef map<string, plen_t> directory_t;
 typedef pair<plen_t, plen_t> bm_p;
 typedef map<plen_t, bm_p> bm_t;
@@ -84,6 +135,8 @@ package::package(const char* file, bool writeable, bool empty)
 #ifdef DO_FSYNC
     , tmp(false)
 #endif
+    , codec(SAVE_CODEC_ZLIB), zlib_level(-1 /* Z_DEFAULT_COMPRESSION */),
+    worker(nullptr)
 {
     dprintf("package: initializing file=\"%s\" rw=%d\n", file, writeable);
     ASSERT(writeable || !empty);
@@ -134,6 +187,8 @@ package::package()
 #ifdef DO_FSYNC
     , tmp(true)
 #endif
+    , codec(SAVE_CODEC_ZLIB), zlib_level(-1 /* Z_DEFAULT_COMPRESSION */),
+    worker(nullptr)
 {
     dprintf("package: initializing tmp file\n");
     filename = "[tmp]";
@@ -161,8 +216,8 @@ void package::load()
     ssize_t res = ::read(fd, &head, sizeof(file_header));
     if (res < 0)
         sysfail("error reading the save file (%s)", filename.c_str());
-    if (!res || !(head.magic || head.version || head.padding[0]
-                  || head.padding[1] || head.padding[2] || head.start))
+    if (!res || !(head.magic || head.version || head.codec || head.padding[0]
+                  || head.padding[1] || head.start))
     {
         corrupted("The save file (%s) is empty!", filename.c_str());
     }
@@ -174,6 +229,13 @@ void package::load()
         corrupted("save file (%s) corrupted -- not a DCSS save file",
              filename.c_str());
     }
+    if (head.codec >= NUM_SAVE_CODECS)
+    {
+        corrupted("save file (%s) uses an unknown compression method %u",
+                  filename.c_str(), head.codec);
+    }
+    codec = static_cast<save_codec>(head.codec);
+
     off_t len = lseek(fd, 0, SEEK_END);
     if (len == -1)
         sysfail("save file (%s) is not seekable", filename.c_str());
@@ -206,6 +268,7 @@ void package::load_traces()
 package::~package()
 {
     dprintf("package: finalizing\n");
+    stop_worker();
     ASSERT(!n_users || CrawlIsCrashing); // not merely aborted, there are
         // live pointers to us. With normal stack unwinding, destructors
         // will make sure this never happens and this assert is good for
@@ -230,6 +293,21 @@ package::~package()
 }
 
 void package::commit()
+{
+    ASSERT(rw);
+    if (worker)
+    {
+        package_lock lock(worker);
+        if (worker->error)
+            rethrow_exception(worker->error);
+        worker->jobs.push_back({true, "", {}});
+        cond_wake(worker->work_ready);
+        return;
+    }
+    commit_now();
+}
+
+void package::commit_now()
 {
     ASSERT(rw);
     if (!dirty)
@@ -242,7 +320,9 @@ void package::commit()
 
     file_header head;
     head.magic = htole(PACKAGE_MAGIC);
-    head.version = PACKAGE_VERSION;
+    head.version = codec == SAVE_CODEC_ZLIB ? PACKAGE_VERSION
+                                            : PACKAGE_VERSION_CODEC;
+    head.codec = codec;
     memset(&head.padding, 0, sizeof(head.padding));
     head.start = htole(write_directory());
 #ifdef DO_FSYNC
@@ -279,16 +359,221 @@ void package::seek(plen_t to)
 
 chunk_writer* package::writer(const string &name)
 {
+    wait_for_chunk(name);
     return new chunk_writer(this, name);
 }
 
 chunk_reader* package::reader(const string &name)
 {
+    wait_for_chunk(name);
+    package_lock lock(worker);
     if (plen_t *ch = map_find(directory, name))
         return new chunk_reader(this, *ch);
     return 0;
 }
 
+// Existing chunks can't be re-encoded, so only a package that has nothing
+// written yet switches codecs; otherwise just the zlib level changes.
+void package::set_compression(save_compression_type type)
+{
+    package_lock lock(worker);
+    if (directory.empty() && !n_users && (!worker || worker->jobs.empty()))
+    {
+        codec = type == SAVE_COMPRESSION_NONE ? SAVE_CODEC_STORE
+                                              : SAVE_CODEC_ZLIB;
+    }
+#ifdef USE_ZLIB
+    zlib_level = type == SAVE_COMPRESSION_FAST ? Z_BEST_SPEED
+                                               : Z_DEFAULT_COMPRESSION;
+#endif
+}
+
+void package::set_background_writes(bool enabled)
+{
+#ifdef TARGET_OS_WINDOWS
+    // The condition variables in threads.h can miss wakeups on Windows.
+    enabled = false;
+#endif
+    if (!enabled || !rw)
+    {
+        stop_worker();
+        return;
+    }
+    if (worker)
+        return;
+
+    worker = new package_worker;
+    worker->stopping = false;
+    mutex_init(worker->lock);
+    cond_init(worker->work_ready);
+    cond_init(worker->work_done);
+    if (thread_create_joinable(&worker->thread, worker_main, this))
+    {
+        mutex_destroy(worker->lock);
+        cond_destroy(worker->work_ready);
+        cond_destroy(worker->work_done);
+        delete worker;
+        worker = nullptr;
+        dprintf("package: can't start the background writer\n");
+    }
+}
+
+// Takes the contents of data, leaving it empty.
+void package::write_chunk_later(const string &name, vector<unsigned char> &data)
+{
+    ASSERT(worker);
+    ASSERT(name.length() < MAX_CHUNK_NAME_LENGTH);
+    package_lock lock(worker);
+    if (aborted)
+        return;
+    if (worker->error)
+        rethrow_exception(worker->error);
+
+    worker->jobs.push_back({false, name, {}});
+    worker->jobs.back().data.swap(data);
+    cond_wake(worker->work_ready);
+}
+
+// Wait for all queued chunks and commits to be carried out.
+void package::flush_background_writes()
+{
+    if (!worker)
+        return;
+
+    package_lock lock(worker);
+    while (!worker->jobs.empty() && !worker->error)
+        cond_wait(worker->work_done, worker->lock);
+    if (worker->error)
+        rethrow_exception(worker->error);
+}
+
+// Wait until no queued write would replace the given chunk.
+void package::wait_for_chunk(const string &name)
+{
+    if (!worker)
+        return;
+
+    package_lock lock(worker);
+    for (;;)
+    {
+        if (worker->error)
+            rethrow_exception(worker->error);
+        bool pending = false;
+        for (const package_job &job : worker->jobs)
+            if (!job.commit && job.name == name)
+                pending = true;
+        if (!pending)
+            return;
+        cond_wait(worker->work_done, worker->lock);
+    }
+}
+
+// Finish (or, if aborted, drop) any queued work and shut the worker down.
+void package::stop_worker()
+{
+    if (!worker)
+        return;
+
+    mutex_lock(worker->lock);
+    worker->stopping = true;
+    cond_wake(worker->work_ready);
+    mutex_unlock(worker->lock);
+    thread_join(worker->thread);
+
+    mutex_destroy(worker->lock);
+    cond_destroy(worker->work_ready);
+    cond_destroy(worker->work_done);
+    exception_ptr error = worker->error;
+    delete worker;
+    worker = nullptr;
+    if (error && !aborted)
+        rethrow_exception(error);
+}
+
+static void _compress_chunk(const vector<unsigned char> &in,
+                            vector<unsigned char> &out,
+                            save_codec codec, int level)
+{
+#ifdef USE_ZLIB
+    if (codec == SAVE_CODEC_ZLIB)
+    {
+        // Produces the same zlib stream chunk_writer would.
+        uLongf len = compressBound(in.size());
+        out.resize(len);
+        if (compress2(&out[0], &len, in.data(), in.size(), level) != Z_OK)
+            fail("save file compression failed");
+        out.resize(len);
+        return;
+    }
+#endif
+    out = in;
+}
+
+void package::write_packed_chunk(const string &name,
+                                 const vector<unsigned char> &data)
+{
+    chunk_writer cw(this, name, true);
+    if (!data.empty())
+        cw.write(&data[0], data.size());
+}
+
+void *package::worker_main(void *arg)
+{
+    package *pkg = static_cast<package *>(arg);
+    package_worker *w = pkg->worker;
+
+    mutex_lock(w->lock);
+    for (;;)
+    {
+        if (pkg->aborted || w->error)
+            w->jobs.clear();
+        if (w->jobs.empty())
+        {
+            cond_wake(w->work_done);
+            if (w->stopping)
+                break;
+            cond_wait(w->work_ready, w->lock);
+            continue;
+        }
+
+        package_job &job = w->jobs.front();
+        try
+        {
+            if (job.commit)
+                pkg->commit_now();
+            else
+            {
+                // Compression is the slow part; the main thread may use the
+                // package in the meantime. The job can't go away, since only
+                // this thread pops jobs, and abort() leaves the front alone.
+                vector<unsigned char> packed;
+                mutex_unlock(w->lock);
+                try
+                {
+                    _compress_chunk(job.data, packed, pkg->codec,
+                                    pkg->zlib_level);
+                }
+                catch (...)
+                {
+                    mutex_lock(w->lock);
+                    throw;
+                }
+                mutex_lock(w->lock);
+                if (!pkg->aborted)
+                    pkg->write_packed_chunk(job.name, packed);
+            }
+        }
+        catch (...)
+        {
+            w->error = current_exception();
+        }
+        w->jobs.pop_front();
+        cond_wake(w->work_done);
+    }
+    mutex_unlock(w->lock);
+    return nullptr;
+}
+
 plen_t package::extend_block(plen_t at, plen_t size, plen_t by)
 {
     // the header is not counted into the block's size, yet takes space
@@ -382,6 +667,8 @@ void package::free_chunk(const string &name)
 
 void package::delete_chunk(const string &name)
 {
+    wait_for_chunk(name);
+    package_lock lock(worker);
     free_chunk(name);
     directory.erase(name);
 }
@@ -538,6 +825,7 @@ void package::read_directory(plen_t start, uint8_t version)
         }
         break;
     case 1:
+    case 2:
         uint8_t name_len;
         plen_t bstart;
         while (plen_t res = rd.read(&name_len, sizeof(name_len)))
@@ -562,11 +850,25 @@ void package::read_directory(plen_t start, uint8_t version)
 
 bool package::has_chunk(const string &name)
 {
-    return !name.empty() && directory.count(name);
+    if (name.empty())
+        return false;
+
+    package_lock lock(worker);
+    if (directory.count(name))
+        return true;
+    if (worker)
+    {
+        for (const package_job &job : worker->jobs)
+            if (!job.commit && job.name == name)
+                return true;
+    }
+    return false;
 }
 
 vector<string> package::list_chunks()
 {
+    flush_background_writes();
+    package_lock lock(worker);
     vector<string> list;
     list.reserve(directory.size());
     for (const auto &entry : directory)
@@ -617,12 +919,14 @@ void package::abort()
     // Disable any further operations, allow a shutdown. All errors past
     // this point are ignored (assuming we already failed). All writes since
     // the last commit() are lost.
+    package_lock lock(worker);
     aborted = true;
 }
 
 void package::unlink()
 {
     abort();
+    stop_worker();
     close(fd);
     fd = -1;
     ::unlink_u(filename.c_str());
@@ -631,6 +935,7 @@ void package::unlink()
 // the amount of free space not at the end of file
 plen_t package::get_slack()
 {
+    flush_background_writes();
     load_traces();
 
     plen_t slack = 0;
@@ -641,6 +946,7 @@ plen_t package::get_slack()
 
 plen_t package::get_chunk_fragmentation(const string &name)
 {
+    flush_background_writes();
     load_traces();
     ASSERT(directory.count(name)); // not has_chunk(), "" is valid
     plen_t frags = 0;
@@ -657,6 +963,7 @@ plen_t package::get_chunk_fragmentation(const string &name)
 
 plen_t package::get_chunk_compressed_length(const string &name)
 {
+    flush_background_writes();
     load_traces();
     ASSERT(directory.count(name)); // not has_chunk(), "" is valid
     plen_t len = 0;
@@ -671,11 +978,15 @@ plen_t package::get_chunk_compressed_length(const string &name)
     return len;
 }
 
-chunk_writer::chunk_writer(package *parent, const string &_name)
+// If precompressed, the data is written as given, and must already be
+// encoded with the package's codec.
+chunk_writer::chunk_writer(package *parent, const string &_name,
+                           bool _precompressed)
     : first_block(0), cur_block(0), block_len(0)
 {
     ASSERT(parent);
     ASSERT(!parent->aborted);
+    raw = _precompressed || parent->codec != SAVE_CODEC_ZLIB;
 
     // If you need more, please change {read,write}_directory().
     ASSERT(MAX_CHUNK_NAME_LENGTH < 256);
@@ -683,15 +994,20 @@ chunk_writer::chunk_writer(package *parent, const string &_name)
 
     dprintf("chunk_writer(%s): starting\n", _name.c_str());
     pkg = parent;
-    pkg->n_users++;
+    {
+        package_lock lock(pkg->worker);
+        pkg->n_users++;
+    }
     name = _name;
 
 #ifdef USE_ZLIB
+    if (raw)
+        return;
     zs.data_type = Z_BINARY;
     zs.zalloc    = 0;
     zs.zfree     = 0;
     zs.opaque    = Z_NULL;
-    if (deflateInit(&zs, Z_DEFAULT_COMPRESSION))
+    if (deflateInit(&zs, pkg->zlib_level))
         fail("save file compression failed during init: %s", zs.msg);
 #define ZB_SIZE 32768
     zs.next_out  = z_buffer = (Bytef*)malloc(ZB_SIZE);
@@ -703,33 +1019,40 @@ chunk_writer::~chunk_writer()
 {
     dprintf("chunk_writer(%s): closing\n", name.c_str());
 
+    package_lock lock(pkg->worker);
     ASSERT(pkg->n_users > 0);
     pkg->n_users--;
     if (pkg->aborted)
     {
 #ifdef USE_ZLIB
         // ignore errors, they're not relevant anymore
-        deflateEnd(&zs);
-        free(z_buffer);
+        if (!raw)
+        {
+            deflateEnd(&zs);
+            free(z_buffer);
+        }
 #endif
         return;
     }
 
 #ifdef USE_ZLIB
-    zs.avail_in = 0;
-    int res;
-    do
+    if (!raw)
     {
-        res = deflate(&zs, Z_FINISH);
-        if (res != Z_STREAM_END && res != Z_OK && res != Z_BUF_ERROR)
-            fail("save file compression failed: %s", zs.msg);
-        raw_write(z_buffer, zs.next_out - z_buffer);
-        zs.next_out = z_buffer;
-        zs.avail_out = ZB_SIZE;
-    } while (res != Z_STREAM_END);
-    if (deflateEnd(&zs) != Z_OK)
-        fail("save file compression failed during clean-up: %s", zs.msg);
-    free(z_buffer);
+        zs.avail_in = 0;
+        int res;
+        do
+        {
+            res = deflate(&zs, Z_FINISH);
+            if (res != Z_STREAM_END && res != Z_OK && res != Z_BUF_ERROR)
+                fail("save file compression failed: %s", zs.msg);
+            raw_write(z_buffer, zs.next_out - z_buffer);
+            zs.next_out = z_buffer;
+            zs.avail_out = ZB_SIZE;
+        } while (res != Z_STREAM_END);
+        if (deflateEnd(&zs) != Z_OK)
+            fail("save file compression failed during clean-up: %s", zs.msg);
+        free(z_buffer);
+    }
 #endif
     if (cur_block)
         finish_block(0);
@@ -738,6 +1061,7 @@ chunk_writer::~chunk_writer()
 
 void chunk_writer::raw_write(const void *data, plen_t len)
 {
+    package_lock lock(pkg->worker);
     while (len > 0)
     {
         plen_t space = pkg->extend_block(cur_block, block_len, len);
@@ -768,6 +1092,7 @@ void chunk_writer::finish_block(plen_t next)
     head.len = htole(block_len);
     head.next = htole(next);
 
+    package_lock lock(pkg->worker);
     pkg->seek(cur_block);
     if (::write(pkg->fd, &head, sizeof(head)) != sizeof(head))
         sysfail("write error while saving");
@@ -781,6 +1106,12 @@ void chunk_writer::write(const void *data, plen_t len)
     ASSERT(!pkg->aborted);
 
 #ifdef USE_ZLIB
+    if (raw)
+    {
+        raw_write(data, len);
+        return;
+    }
+
     zs.next_in  = (Bytef*)data;
     zs.avail_in = len;
     while (zs.avail_in)
@@ -800,15 +1131,25 @@ void chunk_writer::write(const void *data, plen_t len)
 #endif
 }
 
+// Whether the package has been aborted, so nothing more may be written.
+bool chunk_writer::discarded() const
+{
+    return pkg->aborted;
+}
+
 void chunk_reader::init(plen_t start)
 {
+    package_lock lock(pkg->worker);
     ASSERT(!pkg->aborted);
     pkg->n_users++;
     pkg->reader_count[start]++;
     first_block = next_block = start;
     block_left = 0;
+    raw = pkg->codec != SAVE_CODEC_ZLIB;
 
 #ifdef USE_ZLIB
+    if (raw)
+        return;
     if (!start)
         corrupted("save file corrupted -- zlib header missing");
 
@@ -834,10 +1175,12 @@ chunk_reader::chunk_reader(package *parent, plen_t start)
 chunk_reader::chunk_reader(package *parent, const string &_name)
 {
     ASSERT(parent);
+    parent->wait_for_chunk(_name);
     if (!parent->has_chunk(_name))
         corrupted("save file corrupted -- chunk \"%s\" missing", _name.c_str());
     dprintf("chunk_reader(%s): starting\n", _name.c_str());
     pkg = parent;
+    package_lock lock(pkg->worker);
     init(parent->directory[_name]);
 }
 
@@ -846,9 +1189,10 @@ chunk_reader::~chunk_reader()
     dprintf("chunk_reader: closing\n");
 
 #ifdef USE_ZLIB
-    if (inflateEnd(&zs) != Z_OK)
+    if (!raw && inflateEnd(&zs) != Z_OK)
         fail("save file decompression failed during clean-up: %s", zs.msg);
 #endif
+    package_lock lock(pkg->worker);
     ASSERT(pkg->reader_count[first_block] > 0);
     if (!--pkg->reader_count[first_block])
         pkg->reader_count.erase(first_block);
@@ -858,6 +1202,7 @@ chunk_reader::~chunk_reader()
 
 plen_t chunk_reader::raw_read(void *data, plen_t len)
 {
+    package_lock lock(pkg->worker);
     void *buf = data;
     while (len)
     {
@@ -909,6 +1254,8 @@ plen_t chunk_reader::read(void *data, plen_t len)
         return 0;
 
 #ifdef USE_ZLIB
+    if (raw)
+        return raw_read(data, len);
     if (!len)
         return 0;
     if (eof)
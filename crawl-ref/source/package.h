@@ -17,7 +17,25 @@
 
 typedef uint32_t plen_t;
 
+// How the data of every chunk in a package is encoded. This is recorded in
+// the file header, where saves from before codecs existed have a zero.
+enum save_codec
+{
+    SAVE_CODEC_ZLIB = 0,
+    SAVE_CODEC_STORE,   // uncompressed
+    NUM_SAVE_CODECS
+};
+
+// Values of the save_compression option.
+enum save_compression_type
+{
+    SAVE_COMPRESSION_DEFAULT,   // zlib, default level
+    SAVE_COMPRESSION_FAST,      // zlib, fastest level
+    SAVE_COMPRESSION_NONE,      // stored as is
+};
+
 class package;
+struct package_worker;
 
 class chunk_writer
 {
@@ -31,12 +49,16 @@ private:
     z_stream zs;
     Bytef *z_buffer;
 #endif
+    // Whether data is written to the blocks as is.
+    bool raw;
     void raw_write(const void *data, plen_t len);
     void finish_block(plen_t next);
 public:
-    chunk_writer(package *parent, const string &_name);
+    chunk_writer(package *parent, const string &_name,
+                 bool _precompressed = false);
     ~chunk_writer();
     void write(const void *data, plen_t len);
+    bool discarded() const;
     friend class package;
 };
 
@@ -48,6 +70,8 @@ private:
     package *pkg;
     plen_t first_block, next_block;
     plen_t off, block_left;
+    // Whether the blocks hold the data as is.
+    bool raw;
 #ifdef USE_ZLIB
     bool eof;
     z_stream zs;
@@ -77,6 +101,18 @@ public:
     void abort();
     void unlink();
 
+    // Codec and zlib level for chunks written from now on; the codec only
+    // changes while the package is still empty.
+    void set_compression(save_compression_type type);
+
+    // Background writes: chunks handed over with write_chunk_later() are
+    // compressed and stored by a worker thread, and commits are queued
+    // behind them.
+    void set_background_writes(bool enabled);
+    bool background_writes() const { return worker; }
+    void write_chunk_later(const string &name, vector<unsigned char> &data);
+    void flush_background_writes();
+
     // statistics
     plen_t get_slack();
     plen_t get_size() const { return file_len; };
@@ -99,6 +135,9 @@ private:
     map<plen_t, pair<plen_t, plen_t> > block_map;
     set<plen_t> new_chunks;
     map<plen_t, uint32_t> reader_count;
+    save_codec codec;
+    int zlib_level;
+    package_worker *worker;
     plen_t extend_block(plen_t at, plen_t size, plen_t by);
     plen_t alloc_block(plen_t &size);
     void finish_chunk(const string &name, plen_t at);
@@ -113,6 +152,12 @@ private:
     void trace_chunk(plen_t start);
     void load();
     void load_traces();
+    void commit_now();
+    void write_packed_chunk(const string &name,
+                            const vector<unsigned char> &data);
+    void wait_for_chunk(const string &name);
+    void stop_worker();
+    static void *worker_main(void *arg);
     friend class chunk_writer;
     friend class chunk_reader;
 };
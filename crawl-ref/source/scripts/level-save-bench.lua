@@ -0,0 +1,20 @@
+-- Times saving whole levels to a package chunk and reading them back, as
+-- done on every level change and save. bytes is the stored chunk size.
+-- Usage: level-save-bench [<place> ...]
+
+local niters = 50
+
+local places = script.simple_args()
+if #places == 0 then
+  places = { "D:1", "Lair:3", "Elf:3", "Zot:5" }
+end
+
+crawl.stderr("| place    | write ms | read ms |   bytes |")
+for _, place in ipairs(places) do
+  debug.goto_place(place)
+  test.regenerate_level()
+
+  local write_ms, read_ms, bytes = debug.level_roundtrip(niters)
+  crawl.stderr(string.format("| %-8s | %8.3f | %7.3f | %7d |", place,
+                             write_ms / niters, read_ms / niters, bytes))
+end
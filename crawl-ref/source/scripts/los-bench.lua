@@ -0,0 +1,41 @@
+-- Times both losight() implementations over the debug_los maps that
+-- test/los_maps.lua checks, and makes sure they agree everywhere.
+-- Usage: los-bench [<iterations>]
+
+local args = script.simple_args()
+local niters = tonumber(args[1]) or 200
+
+if not debug.los_bench then
+  error("This build was made with NO_LOS_BITBOARD.")
+end
+
+local total_bv, total_bb, total_centres = 0, 0, 0
+
+crawl.stderr("| map                  | bitvector ms | bitboard ms |")
+local map = dgn.map_by_tag("debug_los")
+assert(map, "Could not find debug-los maps (tag 'debug_los')")
+while map do
+  dgn.reset_level()
+  dgn.tags(map, "no_rotate no_vmirror no_hmirror no_pool_fixup")
+  local name = dgn.name(map)
+  dgn.with_map_anchors(30, 30, function ()
+                                 return dgn.place_map(map, true, true)
+                               end)
+  you.moveto(30, 30)
+
+  local bv_ms, bb_ms, centres, mismatches = debug.los_bench(niters)
+  assert(mismatches == 0, "LOS differs from " .. mismatches
+                          .. " centres in " .. name .. ".")
+  crawl.stderr(string.format("| %-20s | %12.3f | %11.3f |", name,
+                             bv_ms / niters, bb_ms / niters))
+  total_bv = total_bv + bv_ms
+  total_bb = total_bb + bb_ms
+  total_centres = total_centres + centres * niters
+
+  map = dgn.map_by_tag("debug_los")
+end
+
+crawl.stderr(string.format("%d losight() calls each: bitvector %.3f us, "
+                           .. "bitboard %.3f us per call",
+                           total_centres, 1000 * total_bv / total_centres,
+                           1000 * total_bb / total_centres))
@@ -0,0 +1,24 @@
+-- Times encoding the full webtiles refresh a new spectator gets, on fully
+-- mapped levels. Needs a webtiles build.
+-- Usage: webtiles-bench [<place> ...]
+
+local niters = 100
+
+if not debug.webtiles_bench then
+  error("This build was made without USE_TILE_WEB.")
+end
+
+local places = script.simple_args()
+if #places == 0 then
+  places = { "D:1", "Lair:3", "Elf:3", "Zot:5" }
+end
+
+crawl.stderr("| place    | refresh ms |   bytes |")
+for _, place in ipairs(places) do
+  debug.goto_place(place)
+  test.regenerate_level()
+
+  local ms, bytes = debug.webtiles_bench(niters)
+  crawl.stderr(string.format("| %-8s | %10.3f | %7d |", place, ms / niters,
+                             bytes))
+end
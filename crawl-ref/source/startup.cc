@@ -31,6 +31,7 @@
 #include "items.h"
 #include "libutil.h"
 #include "loading-screen.h"
+#include "los.h"
 #include "macro.h"
 #include "maps.h"
 #include "menu.h"
@@ -69,6 +70,61 @@
 
 using namespace ui;
 
+namespace
+{
+    struct startup_phase_time
+    {
+        string name;
+        int depth;
+        chrono::steady_clock::duration time;
+    };
+}
+
+static vector<startup_phase_time> startup_phases;
+static int startup_phase_depth = 0;
+
+startup_phase::startup_phase(const char *name) : m_index(-1)
+{
+    if (!crawl_state.startup_profile)
+        return;
+
+    m_index = startup_phases.size();
+    startup_phases.push_back({name, startup_phase_depth++,
+                              chrono::steady_clock::duration::zero()});
+    m_start = chrono::steady_clock::now();
+}
+
+startup_phase::~startup_phase()
+{
+    if (m_index < 0)
+        return;
+
+    startup_phases[m_index].time = chrono::steady_clock::now() - m_start;
+    --startup_phase_depth;
+}
+
+// Prints the phases timed so far, nested ones indented under the phase
+// they ran in, and exits.
+void print_startup_profile()
+{
+    auto ms = [](chrono::steady_clock::duration d)
+    {
+        return chrono::duration<double, milli>(d).count();
+    };
+
+    auto total = chrono::steady_clock::duration::zero();
+    printf("Startup profile:\n");
+    for (const startup_phase_time &phase : startup_phases)
+    {
+        if (!phase.depth)
+            total += phase.time;
+        printf("  %*s%-*s %9.2f ms\n", phase.depth * 2, "",
+               32 - phase.depth * 2, phase.name.c_str(), ms(phase.time));
+    }
+    printf("  %-32s %9.2f ms\n", "total", ms(total));
+    end(0);
+}
+
 static void _loading_message(string m)
 {
     mpr(m.c_str());
@@ -88,21 +144,24 @@ static void _initialize()
 
     rng::seed(); // don't use any chosen seed yet
 
-    init_char_table(Options.char_set);
-    init_show_table();
-    init_monster_symbols();
-    init_spell_descs();        // This needs to be way up top. {dlb}
-    init_zap_index();
-    init_mut_index();
-    init_sac_index();
-    init_duration_index();
-    init_mon_name_cache();
-    init_mons_spells();
-
-    // init_item_name_cache() needs to be redone after init_char_table()
-    // and init_show_table() have been called, so that the glyphs will
-    // be set to use with item_names_by_glyph_cache.
-    init_item_name_cache();
+    {
+        startup_phase phase("game tables");
+        init_char_table(Options.char_set);
+        init_show_table();
+        init_monster_symbols();
+        init_spell_descs();        // This needs to be way up top. {dlb}
+        init_zap_index();
+        init_mut_index();
+        init_sac_index();
+        init_duration_index();
+        init_mon_name_cache();
+        init_mons_spells();
+
+        // init_item_name_cache() needs to be redone after init_char_table()
+        // and init_show_table() have been called, so that the glyphs will
+        // be set to use with item_names_by_glyph_cache.
+        init_item_name_cache();
+    }
 
     unwind_bool no_more(crawl_state.show_more_prompt, false);
 
@@ -122,7 +181,10 @@ static void _initialize()
     you.unique_items.init(UNIQ_NOT_EXISTS);
 
     // Set up the Lua interpreter for the dungeon builder.
-    init_dungeon_lua();
+    {
+        startup_phase phase("dungeon Lua");
+        init_dungeon_lua();
+    }
 
 #ifdef USE_TILE_LOCAL
     // Draw the splash screen before the database gets initialised as that
@@ -134,23 +196,44 @@ static void _initialize()
 
     // Initialise internal databases.
     _loading_message("Loading databases...");
-    databaseSystemInit();
+    {
+        startup_phase phase("databases");
+        databaseSystemInit();
+    }
 
     _loading_message("Loading spells and features...");
-    init_feat_desc_cache();
-    init_spell_name_cache();
+    {
+        startup_phase phase("spell and feature caches");
+        init_feat_desc_cache();
+        init_spell_name_cache();
 #ifdef DEBUG
-    validate_spellbooks();
+        validate_spellbooks();
 #endif
+    }
 
     // Read special levels and vaults.
     _loading_message("Loading maps...");
-    read_maps();
-    run_map_global_preludes();
+    {
+        startup_phase phase("maps");
+        read_maps();
+    }
+    {
+        startup_phase phase("map global preludes");
+        run_map_global_preludes();
+    }
 
     if (crawl_state.build_db)
         end(0);
 
+    if (crawl_state.startup_profile)
+    {
+        {
+            startup_phase phase("LOS rays");
+            precompute_los_rays();
+        }
+        print_startup_profile();
+    }
+
 #ifdef USE_TILE_LOCAL
     if (!crawl_state.tiles_disabled && crawl_state.title_screen)
         loading_screen_close();
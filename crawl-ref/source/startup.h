@@ -5,5 +5,21 @@
 
 #pragma once
 
+#include <chrono>
+
 bool startup_step();
 void cio_init();
+
+// Times a phase of process startup for the -startup-profile report. Does
+// nothing unless that option was given. Phases may nest.
+class startup_phase
+{
+public:
+    startup_phase(const char *name);
+    ~startup_phase();
+private:
+    int m_index;
+    chrono::steady_clock::time_point m_start;
+};
+
+NORETURN void print_startup_profile();
@@ -251,6 +251,8 @@ enum tag_minor_version
     TAG_MINOR_APPENDAGE,           // Change beastly appendage
     TAG_MINOR_COMPRESS_BADMUTS,    // Reduce some mutations to 2 levels
     TAG_MINOR_BOOK_UNID,           // Remove book ID.
+    TAG_MINOR_LEVEL_GRID_PLANES,   // Save level grids as whole planes
+    TAG_MINOR_LEVEL_SECTIONS,      // Store level sections as separate chunks
 #endif
     NUM_TAG_MINORS,
     TAG_MINOR_VERSION = NUM_TAG_MINORS - 1
@@ -107,16 +107,18 @@ extern set<pair<string, level_id> > auto_unique_annotations;
 extern abyss_state abyssal_state;
 
 reader::reader(const string &_read_filename, int minorVersion)
-    : _filename(_read_filename), _chunk(0), _pbuf(nullptr), _read_offset(0),
-      _minorVersion(minorVersion), _safe_read(false)
+    : _filename(_read_filename), _chunk(0), _pbuf(nullptr), _pbuf_size(0),
+      _read_offset(0), _chunk_offset(0), _minorVersion(minorVersion),
+      _safe_read(false)
 {
     _file       = fopen_u(_filename.c_str(), "rb");
     opened_file = !!_file;
 }
 
 reader::reader(package *save, const string &chunkname, int minorVersion)
-    : _file(0), _chunk(0), opened_file(false), _pbuf(0), _read_offset(0),
-     _minorVersion(minorVersion), _safe_read(false)
+    : _file(0), _chunk(0), opened_file(false), _pbuf(0), _pbuf_size(0),
+      _read_offset(0), _chunk_offset(0), _minorVersion(minorVersion),
+      _safe_read(false)
 {
     ASSERT(save);
     _chunk = new chunk_reader(save, chunkname);
@@ -151,7 +153,7 @@ void reader::advance(size_t offset)
 bool reader::valid() const
 {
     return (_file && !feof(_file)) ||
-           (_pbuf && _read_offset < _pbuf->size());
+           (_pbuf && _read_offset < _pbuf_size);
 }
 
 static NORETURN void _short_read(bool safe_read)
@@ -163,8 +165,20 @@ static NORETURN void _short_read(bool safe_read)
     die_noline("short read while reading save");
 }
 
-// Reads input in network byte order, from a file or buffer.
-unsigned char reader::readByte()
+// Refill the read-ahead buffer from the chunk. Decompressing a block at a
+// time is much cheaper than going through zlib for every single byte.
+bool reader::fill_chunk_buf()
+{
+    ASSERT(_chunk);
+    _chunk_buf.resize(32768);
+    _chunk_buf.resize(_chunk->read(&_chunk_buf[0], _chunk_buf.size()));
+    _chunk_offset = 0;
+    return !_chunk_buf.empty();
+}
+
+// Reads input in network byte order, from a file or buffer. Buffered input
+// is handled inline by readByte(); this covers everything else.
+unsigned char reader::read_byte_slow()
 {
     if (_file)
     {
@@ -175,16 +189,14 @@ unsigned char reader::readByte()
     }
     else if (_chunk)
     {
-        unsigned char buf;
-        if (_chunk->read(&buf, 1) != 1)
+        if (!fill_chunk_buf())
             _short_read(_safe_read);
-        return buf;
+        return _chunk_buf[_chunk_offset++];
     }
     else
     {
-        if (_read_offset >= _pbuf->size())
-            _short_read(_safe_read);
-        return (*_pbuf)[_read_offset++];
+        ASSERT(_read_offset >= _pbuf_size);
+        _short_read(_safe_read);
     }
 }
 
@@ -202,15 +214,27 @@ void reader::read(void *data, size_t size)
     }
     else if (_chunk)
     {
-        if (_chunk->read(data, size) != size)
-            _short_read(_safe_read);
+        unsigned char *out = static_cast<unsigned char*>(data);
+        while (size)
+        {
+            if (_chunk_offset >= _chunk_buf.size() && !fill_chunk_buf())
+                _short_read(_safe_read);
+            const size_t n = min(size, _chunk_buf.size() - _chunk_offset);
+            if (out)
+            {
+                memcpy(out, &_chunk_buf[_chunk_offset], n);
+                out += n;
+            }
+            _chunk_offset += n;
+            size -= n;
+        }
     }
     else
     {
-        if (_read_offset+size > _pbuf->size())
+        if (_read_offset+size > _pbuf_size)
             _short_read(_safe_read);
         if (data && size)
-            memcpy(data, &(*_pbuf)[_read_offset], size);
+            memcpy(data, _pbuf + _read_offset, size);
 
         _read_offset += size;
     }
@@ -230,9 +254,10 @@ void reader::setMinorVersion(int minorVersion)
 void reader::fail_if_not_eof(const string &name)
 {
     char dummy;
-    if (_chunk ? _chunk->read(&dummy, 1) :
+    if (_chunk ? _chunk_offset < _chunk_buf.size()
+                 || _chunk->read(&dummy, 1) :
         _file ? (fgetc(_file) != EOF) :
-        _read_offset >= _pbuf->size())
+        _read_offset >= _pbuf_size)
     {
         fail("Incomplete read of \"%s\" - aborting.", name.c_str());
     }
@@ -248,17 +273,26 @@ void writer::check_ok(bool ok)
     }
 }
 
-void writer::writeByte(unsigned char ch)
+writer::~writer()
 {
-    if (failed)
+    if (_later)
+        _later->write_chunk_later(_chunk_name, _chunk_buf);
+    if (!_chunk)
         return;
 
-    if (_chunk)
-        _chunk->write(&ch, 1);
-    else if (_file)
-        check_ok(fputc(ch, _file) != EOF);
-    else
-        _pbuf->push_back(ch);
+    // Nothing can be written once the save has been abandoned.
+    if (!_chunk->discarded())
+        flush();
+    delete _chunk;
+}
+
+// Hand the staged output over to the chunk writer.
+void writer::flush()
+{
+    ASSERT(_chunk);
+    if (!_chunk_buf.empty())
+        _chunk->write(&_chunk_buf[0], _chunk_buf.size());
+    _chunk_buf.clear();
 }
 
 void writer::write(const void *data, size_t size)
@@ -266,14 +300,14 @@ void writer::write(const void *data, size_t size)
     if (failed)
         return;
 
-    if (_chunk)
-        _chunk->write(data, size);
-    else if (_file)
+    if (_file)
         check_ok(fwrite(data, 1, size, _file) == size);
     else
     {
         const unsigned char* cdata = static_cast<const unsigned char*>(data);
         _pbuf->insert(_pbuf->end(), cdata, cdata+size);
+        if (_chunk && _chunk_buf.size() >= CHUNK_FLUSH_SIZE)
+            flush();
     }
 }
 
@@ -313,6 +347,9 @@ static void tag_read_lost_items(reader &th);
 static void tag_read_companions(reader &th);
 
 static void tag_construct_level(writer &th);
+static void tag_construct_level_header(writer &th);
+static void tag_construct_level_map(writer &th);
+static void tag_construct_level_env(writer &th);
 static void tag_construct_level_items(writer &th);
 static void tag_construct_level_monsters(writer &th);
 static void tag_construct_level_tiles(writer &th);
@@ -379,10 +416,12 @@ void marshallShort(writer &th, short data)
 {
     // TODO: why does this use `short` and `char` when unmarshall uses int16_t??
     CHECK_INITIALIZED(data);
-    const char b2 = (char)(data & 0x00FF);
-    const char b1 = (char)((data & 0xFF00) >> 8);
-    th.writeByte(b1);
-    th.writeByte(b2);
+    const unsigned char buf[2] =
+    {
+        (unsigned char)((data & 0xFF00) >> 8),
+        (unsigned char)(data & 0x00FF),
+    };
+    th.write(buf, sizeof(buf));
 }
 
 // Unmarshall 2 byte short in network order.
@@ -398,15 +437,14 @@ int16_t unmarshallShort(reader &th)
 void marshallInt(writer &th, int32_t data)
 {
     CHECK_INITIALIZED(data);
-    char b4 = (char) (data & 0x000000FF);
-    char b3 = (char)((data & 0x0000FF00) >> 8);
-    char b2 = (char)((data & 0x00FF0000) >> 16);
-    char b1 = (char)((data & 0xFF000000) >> 24);
-
-    th.writeByte(b1);
-    th.writeByte(b2);
-    th.writeByte(b3);
-    th.writeByte(b4);
+    const unsigned char buf[4] =
+    {
+        (unsigned char)((data & 0xFF000000) >> 24),
+        (unsigned char)((data & 0x00FF0000) >> 16),
+        (unsigned char)((data & 0x0000FF00) >> 8),
+        (unsigned char) (data & 0x000000FF),
+    };
+    th.write(buf, sizeof(buf));
 }
 
 // Unmarshall 4 byte signed int in network order.
@@ -1077,6 +1115,65 @@ static dungeon_feature_type unmarshallFeatureType_Info(reader &th)
 }
 #endif
 
+// Terrain and terrain properties are saved as whole planes, column by
+// column like FixedArray stores them, so each grid is staged in a flat
+// buffer and goes through the writer in one piece.
+static void _marshall_feature_plane(writer &th, const feature_grid &g)
+{
+    vector<unsigned char> buf(GXM * GYM);
+    unsigned char *p = &buf[0];
+    for (int x = 0; x < GXM; x++)
+        for (int y = 0; y < GYM; y++)
+            *p++ = g[x][y];
+    th.write(&buf[0], buf.size());
+}
+
+static void _unmarshall_feature_plane(reader &th, feature_grid &g)
+{
+    vector<unsigned char> buf(GXM * GYM);
+    th.read(&buf[0], buf.size());
+    const unsigned char *p = &buf[0];
+    for (int x = 0; x < GXM; x++)
+        for (int y = 0; y < GYM; y++)
+        {
+            g[x][y] = rewrite_feature(
+                static_cast<dungeon_feature_type>(*p++), th.getMinorVersion());
+            ASSERT(g[x][y] < NUM_FEATURES);
+        }
+}
+
+static void _marshall_property_plane(writer &th,
+    const FixedArray<terrain_property_t, GXM, GYM> &g)
+{
+    vector<unsigned char> buf(GXM * GYM * 4);
+    unsigned char *p = &buf[0];
+    for (int x = 0; x < GXM; x++)
+        for (int y = 0; y < GYM; y++)
+        {
+            const uint32_t flags = g[x][y].flags;
+            *p++ = (flags >> 24) & 0xFF;
+            *p++ = (flags >> 16) & 0xFF;
+            *p++ = (flags >> 8) & 0xFF;
+            *p++ = flags & 0xFF;
+        }
+    th.write(&buf[0], buf.size());
+}
+
+static void _unmarshall_property_plane(reader &th,
+    FixedArray<terrain_property_t, GXM, GYM> &g)
+{
+    vector<unsigned char> buf(GXM * GYM * 4);
+    th.read(&buf[0], buf.size());
+    const unsigned char *p = &buf[0];
+    for (int x = 0; x < GXM; x++)
+        for (int y = 0; y < GYM; y++)
+        {
+            g[x][y].flags = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16
+                            | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+            p += 4;
+        }
+}
+
 #define CANARY     marshallUByte(th, 171)
 #if TAG_MAJOR_VERSION == 34
 #define EAT_CANARY do if (th.getMinorVersion() >= TAG_MINOR_CANARIES    \
@@ -1218,6 +1315,43 @@ void tag_write(tag_type tagID, writer &outf)
     outf.write(&buf[0], buf.size());
 }
 
+// Write the current level as separate sections, for saving each to its own
+// chunk. The sections, concatenated in order, hold exactly the data that
+// tag_write(TAG_LEVEL) writes after its length header.
+void tag_write_level_sections(vector<vector<unsigned char>> &sections)
+{
+    sections.assign(NUM_LEVEL_SECTIONS, vector<unsigned char>());
+
+    for (int i = 0; i < NUM_LEVEL_SECTIONS; ++i)
+    {
+        writer th(&sections[i]);
+        switch (i)
+        {
+        case LEVEL_SECTION_HEADER:
+            tag_construct_level_header(th);
+            break;
+        case LEVEL_SECTION_MAP:
+            tag_construct_level_map(th);
+            break;
+        case LEVEL_SECTION_ENV:
+            tag_construct_level_env(th);
+            break;
+        case LEVEL_SECTION_ITEMS:
+            CANARY;
+            tag_construct_level_items(th);
+            break;
+        case LEVEL_SECTION_MONSTERS:
+            CANARY;
+            tag_construct_level_monsters(th);
+            break;
+        case LEVEL_SECTION_TILES:
+            CANARY;
+            tag_construct_level_tiles(th);
+            break;
+        }
+    }
+}
+
 static void _shunt_monsters_out_of_walls()
 {
     for (int i = 0; i < MAX_MONSTERS; ++i)
@@ -1240,6 +1374,7 @@ static void _shunt_monsters_out_of_walls()
                          m.pos().x, m.pos().y);
                     env.mgrid(m.pos()) = NON_MONSTER;
                     m.position = *di;
+                    monster_index_moved(m);
                     env.mgrid(*di) = i;
                     break;
                 }
@@ -4509,6 +4644,13 @@ static int _last_used_index(const Z &thinglist, int max_things)
 // ------------------------------- level tags ---------------------------- //
 
 static void tag_construct_level(writer &th)
+{
+    tag_construct_level_header(th);
+    tag_construct_level_map(th);
+    tag_construct_level_env(th);
+}
+
+static void tag_construct_level_header(writer &th)
 {
     marshallByte(th, env.floor_colour);
     marshallByte(th, env.rock_colour);
@@ -4523,16 +4665,17 @@ static void tag_construct_level(writer &th)
     marshallShort(th, GYM);
 
     marshallInt(th, env.turns_on_level);
+}
 
+static void tag_construct_level_map(writer &th)
+{
     CANARY;
 
+    _marshall_feature_plane(th, env.grid);
+    _marshall_property_plane(th, env.pgrid);
     for (int count_x = 0; count_x < GXM; count_x++)
         for (int count_y = 0; count_y < GYM; count_y++)
-        {
-            marshallByte(th, grd[count_x][count_y]);
             marshallMapCell(th, env.map_knowledge[count_x][count_y]);
-            marshallInt(th, env.pgrid[count_x][count_y].flags);
-        }
 
     marshallBoolean(th, !!env.map_forgotten);
     if (env.map_forgotten)
@@ -4541,7 +4684,10 @@ static void tag_construct_level(writer &th)
                 marshallMapCell(th, (*env.map_forgotten)[x][y]);
 
     _run_length_encode(th, marshallByte, env.grid_colours, GXM, GYM);
+}
 
+static void tag_construct_level_env(writer &th)
+{
     CANARY;
 
     // how many clouds?
@@ -6038,18 +6184,27 @@ static void tag_read_level(reader &th)
     env.map_seen.reset();
 #if TAG_MAJOR_VERSION == 34
     vector<coord_def> transporters;
+    const bool interleaved = th.getMinorVersion() < TAG_MINOR_LEVEL_GRID_PLANES;
+    if (!interleaved)
 #endif
+    {
+        _unmarshall_feature_plane(th, env.grid);
+        _unmarshall_property_plane(th, env.pgrid);
+    }
     for (int i = 0; i < gx; i++)
         for (int j = 0; j < gy; j++)
         {
-            dungeon_feature_type feat = unmarshallFeatureType(th);
-            grd[i][j] = feat;
-            ASSERT(feat < NUM_FEATURES);
-
 #if TAG_MAJOR_VERSION == 34
-            // Save these for potential destination clean up.
-            if (grd[i][j] == DNGN_TRANSPORTER)
-                transporters.push_back(coord_def(i, j));
+            if (interleaved)
+            {
+                dungeon_feature_type feat = unmarshallFeatureType(th);
+                grd[i][j] = feat;
+                ASSERT(feat < NUM_FEATURES);
+
+                // Save these for potential destination clean up.
+                if (grd[i][j] == DNGN_TRANSPORTER)
+                    transporters.push_back(coord_def(i, j));
+            }
 #endif
             unmarshallMapCell(th, env.map_knowledge[i][j]);
             // Fixup positions
@@ -6061,10 +6216,12 @@ static void tag_read_level(reader &th)
             env.map_knowledge[i][j].flags &= ~MAP_VISIBLE_FLAG;
             if (env.map_knowledge[i][j].seen())
                 env.map_seen.set(i, j);
-            env.pgrid[i][j].flags = unmarshallInt(th);
-
-            mgrd[i][j] = NON_MONSTER;
+#if TAG_MAJOR_VERSION == 34
+            if (interleaved)
+                env.pgrid[i][j].flags = unmarshallInt(th);
+#endif
         }
+    env.mgrid.init(NON_MONSTER);
 
 #if TAG_MAJOR_VERSION == 34
     if (th.getMinorVersion() < TAG_MINOR_FORGOTTEN_MAP)
@@ -6332,6 +6489,7 @@ void unmarshallMonster(reader &th, monster& m)
     m.type           = unmarshallMonType(th);
     if (m.type == MONS_NO_MONSTER)
         return;
+    monster_slot_taken(m);
 
     ASSERT(!invalid_monster_type(m.type));
 
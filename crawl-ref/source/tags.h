@@ -28,6 +28,18 @@ enum tag_type   // used during save/load process to identify data blocks
     TAG_SKIP
 };
 
+// The parts a level is split into when saved; see tag_write_level_sections().
+enum level_section
+{
+    LEVEL_SECTION_HEADER,               // colours, time, size
+    LEVEL_SECTION_MAP,                  // terrain and map knowledge
+    LEVEL_SECTION_ENV,                  // clouds, shops, markers, properties
+    LEVEL_SECTION_ITEMS,
+    LEVEL_SECTION_MONSTERS,
+    LEVEL_SECTION_TILES,
+    NUM_LEVEL_SECTIONS
+};
+
 /* ***********************************************************************
  * writer API
  * *********************************************************************** */
@@ -37,24 +49,50 @@ class writer
 public:
     writer(const string &filename, FILE* output, bool ignore_errors = false)
         : _filename(filename), _file(output), _chunk(0),
-          _ignore_errors(ignore_errors), _pbuf(0), failed(false)
+          _ignore_errors(ignore_errors), _pbuf(0), _later(nullptr),
+          failed(false)
     {
         ASSERT(output);
     }
     writer(vector<unsigned char>* poutput)
         : _filename(), _file(0), _chunk(0), _ignore_errors(false),
-          _pbuf(poutput), failed(false) { ASSERT(poutput); }
+          _pbuf(poutput), _later(nullptr), failed(false) { ASSERT(poutput); }
+    // Output to a save chunk is staged in an internal buffer and handed to
+    // the (compressing) chunk_writer in large blocks, or, if the package
+    // writes in the background, handed over in one piece when done.
     writer(package *save, const string &chunkname)
         : _filename(), _file(0), _chunk(0), _ignore_errors(false),
-          failed(false)
+          _pbuf(&_chunk_buf), _later(nullptr), failed(false)
     {
         ASSERT(save);
-        _chunk = save->writer(chunkname);
+        if (save->background_writes())
+        {
+            _later = save;
+            _chunk_name = chunkname;
+        }
+        else
+        {
+            _chunk = save->writer(chunkname);
+            _chunk_buf.reserve(CHUNK_FLUSH_SIZE);
+        }
     }
 
-    ~writer() { if (_chunk) delete _chunk; }
+    ~writer();
 
-    void writeByte(unsigned char byte);
+    void writeByte(unsigned char byte)
+    {
+        if (failed)
+            return;
+
+        if (_file)
+            check_ok(fputc(byte, _file) != EOF);
+        else
+        {
+            _pbuf->push_back(byte);
+            if (_chunk && _chunk_buf.size() >= CHUNK_FLUSH_SIZE)
+                flush();
+        }
+    }
     void write(const void *data, size_t size);
     long tell();
 
@@ -62,6 +100,9 @@ public:
 
 private:
     void check_ok(bool ok);
+    void flush();
+
+    static const size_t CHUNK_FLUSH_SIZE = 65536;
 
 private:
     string _filename;
@@ -70,6 +111,9 @@ private:
     bool _ignore_errors;
 
     vector<unsigned char>* _pbuf;
+    vector<unsigned char> _chunk_buf;
+    package *_later;
+    string _chunk_name;
 
     bool failed;
 };
@@ -99,16 +143,30 @@ public:
     reader(const string &filename, int minorVersion = TAG_MINOR_INVALID);
     reader(FILE* input, int minorVersion = TAG_MINOR_INVALID)
         : _file(input), _chunk(0), opened_file(false), _pbuf(0),
-          _read_offset(0), _minorVersion(minorVersion), _safe_read(false) {}
+          _pbuf_size(0), _read_offset(0), _chunk_offset(0),
+          _minorVersion(minorVersion), _safe_read(false) {}
     reader(const vector<unsigned char>& input,
            int minorVersion = TAG_MINOR_INVALID)
-        : _file(0), _chunk(0), opened_file(false), _pbuf(&input),
-          _read_offset(0), _minorVersion(minorVersion), _safe_read(false) {}
+        : _file(0), _chunk(0), opened_file(false), _pbuf(input.data()),
+          _pbuf_size(input.size()), _read_offset(0), _chunk_offset(0),
+          _minorVersion(minorVersion), _safe_read(false) {}
+    reader(const unsigned char *input, size_t size,
+           int minorVersion = TAG_MINOR_INVALID)
+        : _file(0), _chunk(0), opened_file(false), _pbuf(input),
+          _pbuf_size(size), _read_offset(0), _chunk_offset(0),
+          _minorVersion(minorVersion), _safe_read(false) {}
     reader(package *save, const string &chunkname,
            int minorVersion = TAG_MINOR_INVALID);
     ~reader();
 
-    unsigned char readByte();
+    unsigned char readByte()
+    {
+        if (_pbuf && _read_offset < _pbuf_size)
+            return _pbuf[_read_offset++];
+        if (_chunk && _chunk_offset < _chunk_buf.size())
+            return _chunk_buf[_chunk_offset++];
+        return read_byte_slow();
+    }
     void read(void *data, size_t size);
     void advance(size_t size);
     int getMinorVersion() const;
@@ -121,13 +179,21 @@ public:
 
     void set_safe_read(bool setting) { _safe_read = setting; }
 
+private:
+    unsigned char read_byte_slow();
+    bool fill_chunk_buf();
+
 private:
     string _filename;
     FILE* _file;
     chunk_reader *_chunk;
     bool  opened_file;
-    const vector<unsigned char>* _pbuf;
+    const unsigned char *_pbuf;
+    size_t _pbuf_size;
     unsigned int _read_offset;
+    // Read-ahead of decompressed chunk data; see fill_chunk_buf().
+    vector<unsigned char> _chunk_buf;
+    size_t _chunk_offset;
     int _minorVersion;
     // always throw an exception rather than dying when reading past EOF
     bool _safe_read;
@@ -169,6 +235,7 @@ static inline void unmarshallSigned(reader& th, T& v)
 
 void tag_read(reader &inf, tag_type tag_id);
 void tag_write(tag_type tagID, writer &outf);
+void tag_write_level_sections(vector<vector<unsigned char>> &sections);
 void tag_read_char(reader &th, uint8_t format, uint8_t major, uint8_t minor);
 
 vector<ghost_demon> tag_read_ghosts(reader &th);
@@ -39,6 +39,7 @@
 #include "mon-poly.h"
 #include "mon-util.h"
 #include "mon-death.h"
+#include "mon-pathfind.h"
 #include "ouch.h"
 #include "player.h"
 #include "random.h"
@@ -2012,6 +2013,7 @@ void set_terrain_changed(const coord_def p)
     dungeon_events.fire_position_event(DET_FEAT_CHANGE, p);
 
     los_terrain_changed(p);
+    invalidate_player_distance_fields();
 
     for (orth_adjacent_iterator ai(p); ai; ++ai)
         if (actor *act = actor_at(*ai))
@@ -0,0 +1,5 @@
+-- Check that the LOS ray tables read from the ray cache are the same as
+-- the ones computed by the precomputation.
+
+assert(debug.los_ray_cache_matches(),
+       "LOS ray tables from the cache differ from the computed ones")
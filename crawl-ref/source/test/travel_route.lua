@@ -0,0 +1,39 @@
+-- Check the routes interlevel travel finds over a made-up layout of open
+-- levels, where walking costs the grid distance and taking a stair 500.
+
+local layout = {
+  ["D:1"] = { { 10, 10, "D:2", 10, 10 }, { 50, 10, "D:2", 50, 40 } },
+  ["D:2"] = { { 10, 10, "D:1", 10, 10 }, { 50, 40, "D:1", 50, 10 },
+              { 30, 30, "D:3", 30, 30 } },
+  ["D:3"] = { { 30, 30, "D:2", 30, 30 } },
+  -- Shafted into: no stairs seen yet.
+  ["D:4"] = { },
+  ["D:5"] = { { 20, 20, "D:6", 20, 20 } },
+  ["D:6"] = { { 20, 20, "D:5", 20, 20 } },
+}
+
+local function check_route(from, x, y, to, tx, ty, want, want_x, want_y)
+  local dist, sx, sy = debug.travel_route(layout, from, x, y, to, tx, ty)
+  local desc = from .. " (" .. x .. "," .. y .. ") to " .. to
+  if tx then
+    desc = desc .. " (" .. tx .. "," .. ty .. ")"
+  end
+  assert(dist == want and sx == want_x and sy == want_y,
+         "Route from " .. desc .. " is " .. dist .. " via (" .. sx .. ","
+         .. sy .. "), expected " .. want .. " via (" .. want_x .. ","
+         .. want_y .. ")")
+end
+
+-- Each of D:1's stairs is the better start from beside it.
+check_route("D:1", 12, 10, "D:3", nil, nil, 1022, 10, 10)
+check_route("D:1", 48, 10, "D:3", nil, nil, 1022, 50, 10)
+
+-- An exact target adds the walk from the arrival stair.
+check_route("D:1", 12, 10, "D:3", 35, 30, 1027, 10, 10)
+
+-- A target on the same level is walked to directly.
+check_route("D:1", 12, 10, "D:1", 40, 10, 28, 40, 10)
+
+-- A level without known stairs has no way out, even though the next level
+-- has stairs that lead to the target.
+check_route("D:4", 21, 20, "D:6", nil, nil, -1, -1, -1)
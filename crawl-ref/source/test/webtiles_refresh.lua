@@ -0,0 +1,8 @@
+-- Check that the full refresh a webtiles destination gets after falling
+-- behind doesn't keep pending changes from the other destinations.
+
+-- Only webtiles builds have the check.
+if debug.webtiles_refresh_syncs then
+  assert(debug.webtiles_refresh_syncs(),
+         "A webtiles refresh left the other destinations out of sync")
+end
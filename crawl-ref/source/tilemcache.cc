@@ -11,6 +11,7 @@
 #include "mon-util.h"
 #include "mutant-beast.h"
 #include "options.h"
+#include "stringutil.h"
 #include "tile-flags.h"
 #include "tiledef-player.h"
 #include "tiledoll.h"
@@ -152,6 +153,33 @@ tileidx_t tile_fg_store::operator=(tileidx_t tile)
 /////////////////////////////////////////////////////////////////////////////
 // mcache_manager
 
+// Everything that goes into drawing an entry, as a string of tile indices.
+static string _entry_key(const mcache_entry &entry)
+{
+    vector<tileidx_t> key;
+    key.push_back(entry.transparent());
+
+    tile_draw_info dinfo[mcache_entry::MAX_INFO_COUNT];
+    const int count = entry.info(&dinfo[0]);
+    key.push_back(count);
+    for (int i = 0; i < count; i++)
+    {
+        key.push_back(dinfo[i].idx);
+        key.push_back(dinfo[i].ofs_x);
+        key.push_back(dinfo[i].ofs_y);
+    }
+
+    if (const dolls_data *doll = entry.doll())
+        key.insert(key.end(), doll->parts, doll->parts + TILEP_PART_MAX);
+
+    return string((const char *) key.data(), key.size() * sizeof(tileidx_t));
+}
+
+mcache_manager::mcache_manager()
+    : m_frame(0), m_hits(0), m_misses(0), m_evictions(0)
+{
+}
+
 mcache_manager::~mcache_manager()
 {
     clear_all();
@@ -159,7 +187,6 @@ mcache_manager::~mcache_manager()
 
 unsigned int mcache_manager::register_monster(const monster_info& minf)
 {
-    // TODO enne - is it worth it to search against all mcache entries?
     // TODO enne - pool mcache types to avoid too much alloc/dealloc?
 
     mcache_entry *entry;
@@ -186,6 +213,19 @@ unsigned int mcache_manager::register_monster(const monster_info& minf)
     else
         return 0;
 
+    string key = _entry_key(*entry);
+    auto found = m_by_key.find(key);
+    if (found != m_by_key.end())
+    {
+        delete entry;
+        m_hits++;
+        m_entries[found->second]->m_last_used = m_frame;
+        return TILEP_MCACHE_START + found->second;
+    }
+
+    m_misses++;
+    entry->m_last_used = m_frame;
+
     tileidx_t idx = ~0;
 
     for (unsigned int i = 0; i < m_entries.size(); i++)
@@ -204,24 +244,67 @@ unsigned int mcache_manager::register_monster(const monster_info& minf)
         m_entries.push_back(entry);
     }
 
+    m_by_key[key] = idx;
+    entry->m_key = move(key);
+
     return TILEP_MCACHE_START + idx;
 }
 
+// Called once per view update: if too many entries are unreferenced, delete
+// the ones least recently registered.
 void mcache_manager::clear_nonref()
 {
-    for (mcache_entry *&entry : m_entries)
-    {
-        if (!entry || entry->ref_count() > 0)
-            continue;
+    m_frame++;
 
-        delete entry;
-        entry = nullptr;
-    }
+    vector<unsigned int> unreferenced;
+    for (unsigned int i = 0; i < m_entries.size(); i++)
+        if (m_entries[i] && m_entries[i]->ref_count() <= 0)
+            unreferenced.push_back(i);
+
+    if (unreferenced.size() <= MAX_UNREFERENCED)
+        return;
+
+    const size_t excess = unreferenced.size() - MAX_UNREFERENCED;
+    nth_element(unreferenced.begin(), unreferenced.begin() + excess,
+                unreferenced.end(),
+                [this](unsigned int a, unsigned int b)
+                {
+                    return m_entries[a]->m_last_used
+                           < m_entries[b]->m_last_used;
+                });
+    for (size_t i = 0; i < excess; i++)
+        _remove(unreferenced[i]);
+    m_evictions += excess;
 }
 
 void mcache_manager::clear_all()
 {
     deleteAll(m_entries);
+    m_by_key.clear();
+}
+
+void mcache_manager::_remove(unsigned int i)
+{
+    m_by_key.erase(m_entries[i]->m_key);
+    delete m_entries[i];
+    m_entries[i] = nullptr;
+}
+
+string mcache_manager::stats() const
+{
+    int live = 0, referenced = 0;
+    for (const mcache_entry *entry : m_entries)
+    {
+        if (!entry)
+            continue;
+        live++;
+        if (entry->m_ref_count > 0)
+            referenced++;
+    }
+
+    return make_stringf("%d entries (%d referenced), %u hits, %u misses, "
+                        "%u evictions", live, referenced, m_hits, m_misses,
+                        m_evictions);
 }
 
 mcache_entry *mcache_manager::get(tileidx_t tile)
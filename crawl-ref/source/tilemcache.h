@@ -6,6 +6,8 @@
 #ifdef USE_TILE
 #pragma once
 
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 struct dolls_data;
@@ -17,6 +19,10 @@ struct dolls_data;
 // Monster cache entries for monsters that are out of sight are ref-counted
 // that they can be drawn even if that monster no longer exists. When no
 // out-of-sight tiles refer to them, they can be deleted.
+//
+// Monsters that would be drawn identically share an entry, so a monster keeps
+// the same tile from turn to turn. Up to MAX_UNREFERENCED entries nothing
+// refers to are kept around for that, the least recently used going first.
 
 class tile_draw_info
 {
@@ -34,7 +40,7 @@ public:
 class mcache_entry
 {
 public:
-    mcache_entry() : m_ref_count(0) {}
+    mcache_entry() : m_ref_count(0), m_last_used(0) {}
     virtual ~mcache_entry() {}
 
     void inc_ref() { m_ref_count++; }
@@ -57,13 +63,26 @@ protected:
 
     // ref count in backstore
     int m_ref_count;
+
+    friend class mcache_manager;
+    // What the entry draws, and the mcache_manager frame it was last
+    // registered in.
+    string m_key;
+    unsigned int m_last_used;
 };
 
 class mcache_manager
 {
 public:
+    mcache_manager();
     ~mcache_manager();
 
+    enum
+    {
+        // How many entries nothing refers to are kept for reuse.
+        MAX_UNREFERENCED = 256
+    };
+
     unsigned int register_monster(const monster_info& mon);
     mcache_entry *get(tileidx_t idx);
 
@@ -72,8 +91,21 @@ public:
 
     bool empty() { return m_entries.empty(); }
 
+    string stats() const;
+
 protected:
     vector<mcache_entry*> m_entries;
+    // Live entries by what they draw, as indices into m_entries.
+    unordered_map<string, unsigned int> m_by_key;
+    unsigned int m_frame;
+
+    // Registrations that found an identical entry, ones that had to add
+    // one, and unreferenced entries thrown out to stay in bounds.
+    unsigned int m_hits;
+    unsigned int m_misses;
+    unsigned int m_evictions;
+
+    void _remove(unsigned int i);
 };
 
 // The global monster cache.
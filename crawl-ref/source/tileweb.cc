@@ -5,18 +5,21 @@
 #include "tileweb.h"
 
 #include <cerrno>
+#include <chrono>
 #include <cstdarg>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #include "artefact.h"
 #include "branch.h"
 #include "command.h"
 #include "coord.h"
 #include "directn.h"
+#include "end.h"
 #include "english.h"
 #include "env.h"
 #include "files.h"
@@ -29,6 +32,7 @@
 #include "menu.h"
 #include "outer-menu.h"
 #include "message.h"
+#include "output.h"
 #include "mon-util.h"
 #include "notes.h"
 #include "options.h"
@@ -39,6 +43,7 @@
 #include "skills.h"
 #include "state.h"
 #include "stringutil.h"
+#include "syscalls.h"
 #include "throw.h"
 #include "tile-flags.h"
 #include "tile-player-flag-cut.h"
@@ -73,9 +78,26 @@ static unsigned int get_milliseconds()
 TilesFramework tiles;
 
 TilesFramework::TilesFramework() :
+      m_replay_compact(false),
+      m_replay_deflate(false),
+      m_encoded_bytes(0),
+      m_next_dest_id(0),
+      m_only_dest(-1),
+      m_compact_msg(false),
+      m_compact_after_name(false),
       m_controlled_from_web(false),
       _send_lock(false),
+      m_record_file(nullptr),
+      m_record_seed(0),
+      m_replay_file(nullptr),
+      m_output_file(nullptr),
+      m_replayed(0),
+      m_send_time(),
+      m_send_calls(),
       m_last_ui_state(UI_INIT),
+      m_last_tick_redraw(0),
+      m_redraw_delay(0),
+      m_need_redraw(false),
       m_view_loaded(false),
       m_current_view(coord_def(GXM, GYM)),
       m_next_view(coord_def(GXM, GYM)),
@@ -85,7 +107,8 @@ TilesFramework::TilesFramework() :
       m_next_flash_colour(BLACK),
       m_need_full_map(true),
       m_text_menu("menu_txt"),
-      m_print_fg(15)
+      m_print_fg(15),
+      m_player_hud_generation(0)
 {
     screen_cell_t default_cell;
     default_cell.tile.bg = TILE_FLAG_UNSEEN;
@@ -99,9 +122,25 @@ TilesFramework::~TilesFramework()
 
 void TilesFramework::shutdown()
 {
+    for (FILE **file : { &m_record_file, &m_replay_file, &m_output_file })
+    {
+        if (*file)
+            fclose(*file);
+        *file = nullptr;
+    }
+
     if (m_sock_name.empty())
         return;
 
+    // Give backed up destinations a last second to take what's queued.
+    for (int tries = 0; tries < 50 && _have_queued(); ++tries)
+    {
+        for (WebtilesDest &dest : m_dests)
+            if (!_send_queued(dest))
+                dest.queue.clear();
+        usleep(20 * 1000);
+    }
+
     close(m_sock);
     remove(m_sock_name.c_str());
 }
@@ -119,8 +158,29 @@ bool TilesFramework::initialise()
     // Initially, switch to CRT.
     cgotoxy(1, 1, GOTO_CRT);
 
+    _open_record_files();
+
     if (m_sock_name.empty())
+    {
+        // A replay gets everything a server would have.
+        if (m_replay_file)
+        {
+            if (m_replay_compact || m_replay_deflate)
+            {
+                WebtilesDest dest;
+                dest.id = m_next_dest_id++;
+                dest.compact = m_replay_compact;
+                dest.deflate = m_replay_deflate;
+                dest.local = true;
+                m_dests.push_back(dest);
+            }
+            _send_version();
+            send_exit_reason("unknown");
+            _send_options();
+            _send_layout();
+        }
         return true;
+    }
 
     // Init socket
     m_sock = socket(PF_UNIX, SOCK_DGRAM, 0);
@@ -160,134 +220,362 @@ string TilesFramework::get_message()
     return m_msg_buf;
 }
 
+// Format straight onto the end of m_msg_buf.
+void TilesFramework::_append_vformat(const char *format, va_list args)
+{
+    const size_t old_size = m_msg_buf.size();
+    size_t room = 64;
+    while (true)
+    {
+        va_list argp;
+        va_copy(argp, args);
+        m_msg_buf.resize(old_size + room);
+        const int len = vsnprintf(&m_msg_buf[old_size], room, format, argp);
+        va_end(argp);
+
+        if (len < 0)
+            die("Webtiles message format error! (%s)", format);
+        if ((size_t) len < room)
+        {
+            m_msg_buf.resize(old_size + len);
+            return;
+        }
+        room = len + 1;
+    }
+}
+
 void TilesFramework::write_message(const char *format, ...)
 {
-    char buf[2048];
-    int len;
+    if (m_compact_msg)
+        die("Webtiles message error: raw write to a compact message");
 
     va_list argp;
     va_start(argp, format);
-    if ((len = vsnprintf(buf, sizeof(buf), format, argp)) < 0)
-        die("Webtiles message format error! (%s)", format);
-    else if (len >= (int)sizeof(buf))
-        die("Webtiles message too long! (%d)", len);
+    _append_vformat(format, argp);
     va_end(argp);
-
-    m_msg_buf.append(buf);
 }
 
 void TilesFramework::finish_message()
 {
+    const bool compact = m_compact_msg;
+    m_compact_msg = false;
+    m_compact_after_name = false;
+
     if (m_msg_buf.size() == 0)
         return;
+    m_encoded_bytes += m_msg_buf.size();
+    message_stats *stats = m_replay_file ? &_count_message(compact) : nullptr;
 #ifdef DEBUG_WEBSOCKETS
     const int initial_buf_size = m_msg_buf.size();
     fprintf(stderr, "websocket: About to send %d bytes.\n", initial_buf_size);
 #endif
 
-    if (m_sock_name.empty())
+    if (m_sock_name.empty() && !m_output_file && m_dests.empty())
     {
         m_msg_buf.clear();
         return;
     }
 
-    m_msg_buf.append("\n");
-    const char* fragment_start = m_msg_buf.data();
-    const char* data_end = m_msg_buf.data() + m_msg_buf.size();
-    int fragments = 0;
-    while (fragment_start < data_end)
+    _frame_message(compact);
+    if (m_output_file)
+        fwrite(m_msg_buf.data(), 1, m_msg_buf.size(), m_output_file);
+
+    // Encoded once; a destination that can take it right away gets it
+    // straight from m_msg_buf, and the others share one queued copy. The
+    // same goes for the compressed form, which is only made if some
+    // destination wants it.
+    shared_ptr<const string> msg, deflated_msg;
+    int deflated = -1;
+
+    for (unsigned int i = 0; i < m_dests.size(); ++i)
     {
-        int fragment_size = data_end - fragment_start;
-        if (fragment_size > m_max_msg_size)
-            fragment_size = m_max_msg_size;
-        fragments++;
+        WebtilesDest &dest = m_dests[i];
+        if (m_only_dest >= 0 && dest.id != m_only_dest)
+            continue;
 
-        for (unsigned int i = 0; i < m_dest_addrs.size(); ++i)
+        bool alive = _send_queued(dest);
+
+        // A destination that fell too far behind misses everything until
+        // its full refresh.
+        if (alive && !dest.needs_refresh)
         {
-            int retries = 30;
-            ssize_t sent = 0;
-            while (sent < fragment_size)
+            if (dest.deflate && deflated < 0)
+                deflated = _deflate_message();
+            const bool use_deflate = dest.deflate && deflated > 0;
+            const string &out = use_deflate ? m_deflate_buf : m_msg_buf;
+            shared_ptr<const string> &shared = use_deflate ? deflated_msg
+                                                           : msg;
+            if (stats && dest.local)
+                stats->sent += out.size();
+
+            int result = 1;
+            if (dest.queue.empty())
             {
-                ssize_t retval = sendto(m_sock, fragment_start + sent,
-                    fragment_size - sent, 0, (sockaddr*) &m_dest_addrs[i],
-                    sizeof(sockaddr_un));
+                result = _send_fragments(dest, out);
+                if (result == 0)
+                    dest.sent = 0;
+            }
+
+            if (result > 0)
+            {
+                if (!shared)
+                    shared = make_shared<const string>(out);
+                dest.queue.push_back(shared);
+                dest.queued_bytes += shared->size();
+                if (dest.queued_bytes > MAX_QUEUED_BYTES)
+                    _drop_queued(dest);
+            }
+            alive = result >= 0;
+        }
+
+        if (!alive)
+        {
+            m_dests.erase(m_dests.begin() + i);
+            i--;
+        }
+    }
+
+    m_msg_buf.clear();
+    m_need_flush = true;
 #ifdef DEBUG_WEBSOCKETS
-                fprintf(stderr,
-                            "    trying to send fragment to client %d...", i);
+    fprintf(stderr, "websocket: Queued %d bytes.\n", initial_buf_size);
 #endif
-                if (retval <= 0)
-                {
-                    const char *errmsg = retval == 0 ? "No bytes sent"
-                                                     : strerror(errno);
-                    if (--retries <= 0)
-                        die("Socket write error: %s", errmsg);
+}
+
+static const int MAX_FRAME_HEADER = 11;
+
+// Write a frame header: the marker byte and the payload length as an
+// unsigned LEB128 varint. Returns the header's length.
+static int _frame_header(char *header, char marker, size_t len)
+{
+    int header_len = 0;
+    header[header_len++] = marker;
+    for (; ; len >>= 7)
+    {
+        if (len < 0x80)
+        {
+            header[header_len++] = (char) len;
+            break;
+        }
+        header[header_len++] = (char) (0x80 | (len & 0x7f));
+    }
+    return header_len;
+}
+
+// Add the newline or compact frame header that goes with the message in
+// m_msg_buf.
+void TilesFramework::_frame_message(bool compact)
+{
+    if (!compact)
+    {
+        m_msg_buf.push_back('\n');
+        return;
+    }
+
+    // Prefix the header in place, so m_msg_buf keeps its capacity.
+    char header[MAX_FRAME_HEADER];
+    const int header_len = _frame_header(header, '\xff', m_msg_buf.size());
+    m_msg_buf.insert(0, header, header_len);
+}
+
+/**
+ * Compress the framed message in m_msg_buf into a deflate frame in
+ * m_deflate_buf (see WEBTILES_DEFLATE_VERSION).
+ *
+ * @return whether it's worth sending; false if the message is too small or
+ *         didn't compress.
+ */
+bool TilesFramework::_deflate_message()
+{
+    if (m_msg_buf.size() < MIN_DEFLATE_BYTES)
+        return false;
+
+    // Leave room for the frame header in front of the stream.
+    uLongf stream_len = compressBound(m_msg_buf.size());
+    m_deflate_buf.resize(MAX_FRAME_HEADER + stream_len);
+    // Favour speed: these go out while the player waits.
+    if (compress2((Bytef*) &m_deflate_buf[MAX_FRAME_HEADER], &stream_len,
+                  (const Bytef*) m_msg_buf.data(), m_msg_buf.size(),
+                  Z_BEST_SPEED) != Z_OK)
+    {
+        return false;
+    }
+
+    char header[MAX_FRAME_HEADER];
+    const int header_len = _frame_header(header, '\xfe', stream_len);
+
+    const size_t start = MAX_FRAME_HEADER - header_len;
+    memcpy(&m_deflate_buf[start], header, header_len);
+    m_deflate_buf.resize(MAX_FRAME_HEADER + stream_len);
+    m_deflate_buf.erase(0, start);
 
-                    if (retval == 0 || errno == ENOBUFS || errno == EWOULDBLOCK
-                        || errno == EINTR || errno == EAGAIN)
-                    {
-                        // Wait for half a second at first (up to five), then
-                        // try again.
-                        const int sleep_time = retries > 25 ? 2 * 1000
-                                             : retries > 10 ? 500 * 1000
-                                             : 5000 * 1000;
 #ifdef DEBUG_WEBSOCKETS
-                        fprintf(stderr, "failed (%s), sleeping for %dms.\n",
-                                                    errmsg, sleep_time / 1000);
+    fprintf(stderr, "websocket: Deflated %d bytes to %d.\n",
+            (int) m_msg_buf.size(), (int) m_deflate_buf.size());
 #endif
-                        usleep(sleep_time);
-                    }
-                    else if (errno == ECONNREFUSED || errno == ENOENT)
-                    {
-                        // the other side is dead
+    return m_deflate_buf.size() < m_msg_buf.size();
+}
+
+/**
+ * Send a message, or what's left of it, to a destination, without blocking.
+ *
+ * @param dest  the destination; dest.sent says how much of msg has gone out
+ *              already, and is updated.
+ * @param msg   the whole message.
+ * @return 0 if all of it went, 1 if the socket is backed up, and -1 if the
+ *         destination has gone away and should be forgotten.
+ */
+int TilesFramework::_send_fragments(WebtilesDest &dest, const string &msg)
+{
+    if (dest.local)
+    {
+        if (dest.output)
+            dest.output->append(msg, dest.sent, string::npos);
+        dest.sent = msg.size();
+        return 0;
+    }
+
+    while (dest.sent < msg.size())
+    {
+        const size_t fragment_size = min(msg.size() - dest.sent,
+                                         (size_t) m_max_msg_size);
+        ssize_t retval = sendto(m_sock, msg.data() + dest.sent,
+                                fragment_size, MSG_DONTWAIT,
+                                (sockaddr*) &dest.addr, sizeof(sockaddr_un));
+        if (retval > 0)
+        {
 #ifdef DEBUG_WEBSOCKETS
-                        fprintf(stderr,
-                            "failed (%s), breaking.\n", errmsg);
+            fprintf(stderr, "websocket: fragment size %d sent to %d.\n",
+                    (int) retval, dest.id);
 #endif
-                        m_dest_addrs.erase(m_dest_addrs.begin() + i);
-                        i--;
-                        break;
-                    }
-                    else
-                        die("Socket write error: %s", errmsg);
-                }
-                else
-                {
+            dest.sent += retval;
+            continue;
+        }
+
+        const char *errmsg = retval == 0 ? "No bytes sent" : strerror(errno);
+        if (retval == 0 || errno == ENOBUFS || errno == EWOULDBLOCK
+            || errno == EINTR || errno == EAGAIN)
+        {
 #ifdef DEBUG_WEBSOCKETS
-                    fprintf(stderr, "fragment size %d sent.\n", fragment_size);
+            fprintf(stderr, "websocket: %d is backed up (%s), %d bytes "
+                            "queued.\n", dest.id, errmsg,
+                            (int) dest.queued_bytes);
 #endif
-                    sent += retval;
-                }
-            }
+            return 1;
         }
-
-        fragment_start += fragment_size;
-    }
-    m_msg_buf.clear();
-    m_need_flush = true;
+        else if (errno == ECONNREFUSED || errno == ENOENT)
+        {
+            // the other side is dead
 #ifdef DEBUG_WEBSOCKETS
-    fprintf(stderr, "websocket: Sent %d bytes in %d fragments.\n",
-                                                initial_buf_size, fragments);
+            fprintf(stderr, "websocket: %d is gone (%s).\n", dest.id, errmsg);
 #endif
+            return -1;
+        }
+        else
+            die("Socket write error: %s", errmsg);
+    }
+    return 0;
 }
 
-void TilesFramework::send_message(const char *format, ...)
+/**
+ * Send as much of a destination's queue as its socket will take without
+ * blocking.
+ *
+ * If more than MAX_QUEUED_BYTES are left waiting, everything not yet started
+ * is dropped, and the destination is given a full refresh once it has caught
+ * up (see _service_queues()).
+ *
+ * @return false if the destination has gone away and should be forgotten.
+ */
+bool TilesFramework::_send_queued(WebtilesDest &dest)
 {
-    char buf[2048];
-    int len;
+    while (!dest.queue.empty())
+    {
+        const int result = _send_fragments(dest, *dest.queue.front());
+        if (result < 0)
+            return false;
+        if (result > 0)
+        {
+            if (dest.queued_bytes > MAX_QUEUED_BYTES)
+                _drop_queued(dest);
+            return true;
+        }
 
-    va_list argp;
-    va_start(argp, format);
-    if ((len = vsnprintf(buf, sizeof(buf), format, argp)) >= (int)sizeof(buf)
-        || len == -1)
+        dest.queued_bytes -= dest.queue.front()->size();
+        dest.sent = 0;
+        dest.queue.pop_front();
+    }
+    return true;
+}
+
+// Drop every queued message that hasn't started going out; one that has must
+// be finished, or the receiver would see the start of it glued to whatever
+// came next.
+void TilesFramework::_drop_queued(WebtilesDest &dest)
+{
+    while (dest.queue.size() > (dest.sent ? 1 : 0))
     {
-        if (len == -1)
-            die("Webtiles message format error! (%s)", format);
-        else
-            die("Webtiles message too long! (%d)", len);
+        dest.queued_bytes -= dest.queue.back()->size();
+        dest.queue.pop_back();
     }
-    va_end(argp);
+    dest.needs_refresh = true;
+}
+
+bool TilesFramework::_have_queued() const
+{
+    for (const WebtilesDest &dest : m_dests)
+        if (!dest.queue.empty() || dest.needs_refresh)
+            return true;
+    return false;
+}
+
+// Retry backed up destinations, and resend everything to those that were
+// dropped and have now caught up. Only called while waiting for input, like
+// the full resend for a new spectator.
+void TilesFramework::_service_queues()
+{
+    for (unsigned int i = 0; i < m_dests.size(); ++i)
+    {
+        if (!_send_queued(m_dests[i]))
+        {
+            m_dests.erase(m_dests.begin() + i);
+            i--;
+        }
+    }
+
+    bool synced = false;
+    for (unsigned int i = 0; i < m_dests.size(); ++i)
+    {
+        if (!m_dests[i].needs_refresh || !m_dests[i].queue.empty())
+            continue;
+
+        // A refresh moves on the state that everyone's updates are worked
+        // out from (the current view, player info, sent messages, and so
+        // on), so anything still pending would then reach only this
+        // destination. Send it to the others first.
+        if (!synced)
+        {
+            if (m_view_loaded)
+                m_need_redraw = true;
+            redraw(true);
+            flush_messages();
+            synced = true;
+        }
+
+        m_dests[i].needs_refresh = false;
+        unwind_var<int> only(m_only_dest, m_dests[i].id);
+        flush_messages();
+        _send_everything();
+        flush_messages();
+    }
+}
 
-    m_msg_buf.append(buf);
+void TilesFramework::send_message(const char *format, ...)
+{
+    va_list argp;
+    va_start(argp, format);
+    _append_vformat(format, argp);
+    va_end(argp);
 
     finish_message();
 }
@@ -310,7 +598,7 @@ void TilesFramework::_await_connection()
     if (m_sock_name.empty())
         return;
 
-    while (m_dest_addrs.size() == 0)
+    while (m_dests.size() == 0)
         _receive_control_message();
 }
 
@@ -356,6 +644,9 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
     fprintf(stderr, "websocket: Received control message '%s' in %d byte.\n", msgtype.c_str(), (int) data.size());
 #endif
 
+    if (m_record_file && msgtype != "attach")
+        _record_control_message(data);
+
     int c = 0;
 
     if (msgtype == "attach")
@@ -363,7 +654,24 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
         JsonWrapper primary = json_find_member(obj.node, "primary");
         primary.check(JSON_BOOL);
 
-        m_dest_addrs.push_back(addr);
+        // Servers that don't know the compact encoding won't send this.
+        JsonWrapper compact = json_find_member(obj.node, "compact");
+        const bool want_compact = compact.node
+                                  && compact->tag == JSON_NUMBER
+                                  && (int) compact->number_
+                                     == WEBTILES_COMPACT_VERSION;
+        JsonWrapper deflate = json_find_member(obj.node, "deflate");
+        const bool want_deflate = deflate.node
+                                  && deflate->tag == JSON_NUMBER
+                                  && (int) deflate->number_
+                                     == WEBTILES_DEFLATE_VERSION;
+
+        WebtilesDest dest;
+        dest.addr = addr;
+        dest.id = m_next_dest_id++;
+        dest.compact = want_compact;
+        dest.deflate = want_deflate;
+        m_dests.push_back(dest);
         m_controlled_from_web = primary->bool_;
     }
     else if (msgtype == "key")
@@ -447,8 +755,224 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
     return c;
 }
 
+// Read a whole line, however long, without its newline.
+static bool _read_line(FILE *f, string &line)
+{
+    line.clear();
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), f))
+    {
+        line += buf;
+        if (line.back() == '\n')
+        {
+            line.pop_back();
+            return true;
+        }
+    }
+    return !line.empty();
+}
+
+void TilesFramework::_open_record_files()
+{
+    if (!m_record_name.empty())
+    {
+        m_record_file = fopen_u(m_record_name.c_str(), "w");
+        if (!m_record_file)
+            end(1, true, "Can't write %s", m_record_name.c_str());
+    }
+
+    if (!m_output_name.empty())
+    {
+        m_output_file = fopen_u(m_output_name.c_str(), "wb");
+        if (!m_output_file)
+            end(1, true, "Can't write %s", m_output_name.c_str());
+    }
+
+    if (m_replay_name.empty())
+        return;
+
+    m_replay_file = fopen_u(m_replay_name.c_str(), "r");
+    if (!m_replay_file)
+        end(1, true, "Can't read %s", m_replay_name.c_str());
+
+    // Play the same game: use the seed the recording started with.
+    string line;
+    while (_read_line(m_replay_file, line))
+    {
+        JsonWrapper obj = json_decode(line.c_str());
+        if (!obj.node || obj->tag != JSON_OBJECT)
+            continue;
+        JsonWrapper msg = json_find_member(obj.node, "msg");
+        JsonWrapper seed = json_find_member(obj.node, "seed");
+        if (msg.node && msg->tag == JSON_STRING
+            && !strcmp(msg->string_, "seed")
+            && seed.node && seed->tag == JSON_STRING
+            && sscanf(seed->string_, "%" SCNu64, &Options.seed_from_rc))
+        {
+            Options.seed = Options.seed_from_rc;
+            break;
+        }
+    }
+    rewind(m_replay_file);
+}
+
+// Control messages are recorded one per line, with a "seed" message
+// whenever the game's seed changes; that only happens once a new game
+// has been set up, so a recording should start with a new game.
+void TilesFramework::_record_control_message(const string &data)
+{
+    if (you.game_seed != m_record_seed)
+    {
+        m_record_seed = you.game_seed;
+        fprintf(m_record_file, "{\"msg\":\"seed\",\"seed\":\"%" PRIu64
+                               "\"}\n", m_record_seed);
+    }
+
+    // Whitespace is all a newline can be in valid JSON.
+    string line = data;
+    replace(line.begin(), line.end(), '\n', ' ');
+    fprintf(m_record_file, "%s\n", line.c_str());
+    fflush(m_record_file);
+}
+
+// Stand in for the socket while replaying: handle recorded control messages
+// until one of them is input. Nothing is ever waiting if we're not blocking.
+bool TilesFramework::_replay_input(wint_t &c, bool block)
+{
+    c = 0;
+    if (!block)
+        return false;
+
+    flush_messages();
+
+    string line;
+    while (_read_line(m_replay_file, line))
+    {
+        m_replayed++;
+        try
+        {
+            c = _handle_control_message(sockaddr_un(), line);
+        }
+        catch (JsonWrapper::MalformedException&)
+        {
+            dprf("Malformed control message in replay!");
+            c = 0;
+        }
+
+        if (c != 0)
+            return true;
+    }
+
+    flush_messages();
+    end(0);
+}
+
+// Tally the message in m_msg_buf by type for print_replay_stats(), and
+// return its type's tally.
+TilesFramework::message_stats &TilesFramework::_count_message(bool compact)
+{
+    static const string prefix = "{\"msg\":\"";
+    static const string compact_prefix = "\xa3msg";
+
+    // Messages prefixed with '*' are for the server itself.
+    size_t start = m_msg_buf[0] == '*' ? 1 : 0;
+    string type = "(other)";
+    if (compact)
+    {
+        // Skip the map header; "msg" is always the first member.
+        start = (uint8_t) m_msg_buf[0] == 0xde ? 3 : 1;
+        if (!m_msg_buf.compare(start, compact_prefix.size(), compact_prefix)
+            && start + compact_prefix.size() < m_msg_buf.size())
+        {
+            start += compact_prefix.size();
+            const uint8_t tag = m_msg_buf[start];
+            if ((tag & 0xe0) == 0xa0)
+                type = m_msg_buf.substr(start + 1, tag & 0x1f);
+        }
+    }
+    else if (!m_msg_buf.compare(start, prefix.size(), prefix))
+    {
+        start += prefix.size();
+        const size_t end = m_msg_buf.find('"', start);
+        if (end != string::npos)
+            type = m_msg_buf.substr(start, end - start);
+    }
+
+    message_stats &st = m_message_stats[type];
+    st.count++;
+    // As framed: with the newline, or the compact frame header.
+    char header[MAX_FRAME_HEADER];
+    st.bytes += m_msg_buf.size()
+                + (compact ? _frame_header(header, '\xff', m_msg_buf.size())
+                           : 1);
+    return st;
+}
+
+/**
+ * Print what was sent during a replay (see -webtiles-replay), by message
+ * type, and the time spent building the map and player messages.
+ */
+void TilesFramework::print_replay_stats()
+{
+    if (m_replay_name.empty())
+        return;
+
+    fprintf(stderr, "Replayed %d control messages", m_replayed);
+    if (m_replay_compact || m_replay_deflate)
+    {
+        fprintf(stderr, ", sending as to a server that asked for %s",
+                !m_replay_deflate ? "the compact encoding" :
+                !m_replay_compact ? "deflate"
+                                  : "the compact encoding and deflate");
+    }
+    fprintf(stderr, ".\n\n");
+
+    // Only deflate makes what's sent differ from the framed messages.
+    auto print_stats = [&](const string &name, const message_stats &st)
+    {
+        fprintf(stderr, "%-24s %7d %12zu", name.c_str(), st.count, st.bytes);
+        if (m_replay_deflate)
+            fprintf(stderr, " %12zu", st.sent);
+        fprintf(stderr, "\n");
+    };
+
+    fprintf(stderr, "%-24s %7s %12s", "message", "count", "bytes");
+    if (m_replay_deflate)
+        fprintf(stderr, " %12s", "deflated");
+    fprintf(stderr, "\n");
+    message_stats total = {};
+    for (const auto &entry : m_message_stats)
+    {
+        print_stats(entry.first, entry.second);
+        total.count += entry.second.count;
+        total.bytes += entry.second.bytes;
+        total.sent += entry.second.sent;
+    }
+    print_stats("total", total);
+
+    // _send_monster()'s time is part of _send_map()'s.
+    static const char *timer_names[] =
+    {
+        "_send_map", "_send_player", "  _send_monster",
+    };
+    COMPILE_CHECK(ARRAYSZ(timer_names) == NUM_SEND_TIMERS);
+
+    fprintf(stderr, "\n%-24s %7s %12s\n", "function", "calls", "ms");
+    for (int i = 0; i < NUM_SEND_TIMERS; i++)
+    {
+        fprintf(stderr, "%-24s %7d %12.3f\n", timer_names[i],
+                m_send_calls[i],
+                chrono::duration<double, milli>(m_send_time[i]).count());
+    }
+
+    fprintf(stderr, "\nmcache: %s\n", mcache.stats().c_str());
+}
+
 bool TilesFramework::await_input(wint_t& c, bool block)
 {
+    if (m_replay_file)
+        return _replay_input(c, block);
+
     int result;
     fd_set fds;
     int maxfd = m_sock_name.empty() ? STDIN_FILENO : m_sock;
@@ -464,8 +988,29 @@ bool TilesFramework::await_input(wint_t& c, bool block)
 
             if (block)
             {
+                // Bring the view up to date before waiting. If input is
+                // already there, leave it to the frame budget instead, so a
+                // run of queued keys doesn't send a map update for each.
+                if (m_need_redraw)
+                {
+                    fd_set ready = fds;
+                    timeval poll;
+                    poll.tv_sec = 0;
+                    poll.tv_usec = 0;
+                    if (select(maxfd + 1, &ready, nullptr, nullptr, &poll) == 0)
+                        redraw(true);
+                }
+
                 tiles.flush_messages();
-                result = select(maxfd + 1, &fds, nullptr, nullptr, nullptr);
+                _service_queues();
+
+                // Come back to anything still queued every so often, rather
+                // than waiting on it.
+                timeval retry;
+                retry.tv_sec = 0;
+                retry.tv_usec = 100 * 1000;
+                result = select(maxfd + 1, &fds, nullptr, nullptr,
+                                _have_queued() ? &retry : nullptr);
             }
             else
             {
@@ -479,7 +1024,11 @@ bool TilesFramework::await_input(wint_t& c, bool block)
         while (result == -1 && errno == EINTR);
 
         if (result == 0)
+        {
+            if (block)
+                continue;
             return false;
+        }
         else if (result > 0)
         {
             if (!m_sock_name.empty() && FD_ISSET(m_sock, &fds))
@@ -517,6 +1066,7 @@ void TilesFramework::dump()
         fprintf(stderr, "start: %d end: %d type: %c\n",
                 frame.start, frame.prefix_end, frame.type);
     }
+    fprintf(stderr, "Webtiles mcache: %s\n", mcache.stats().c_str());
 }
 
 void TilesFramework::send_exit_reason(const string& type, const string& message)
@@ -873,6 +1423,33 @@ player_info::player_info()
     position = coord_def(-1, -1);
 }
 
+// Adds the time until it goes out of scope to one of the totals shown by
+// print_replay_stats(). Does nothing unless replaying.
+class send_timer
+{
+public:
+    send_timer(TilesFramework &tf, int type)
+        : m_tiles(tf), m_type(type), m_active(tf.m_replay_file)
+    {
+        if (m_active)
+            m_start = chrono::steady_clock::now();
+    }
+
+    ~send_timer()
+    {
+        if (!m_active)
+            return;
+        m_tiles.m_send_time[m_type] += chrono::steady_clock::now() - m_start;
+        m_tiles.m_send_calls[m_type]++;
+    }
+
+private:
+    TilesFramework &m_tiles;
+    int m_type;
+    bool m_active;
+    chrono::steady_clock::time_point m_start;
+};
+
 /**
  * Send the player properties to the webserver. Any player properties that
  * must be available to the WebTiles client must be sent here through an
@@ -883,8 +1460,17 @@ player_info::player_info()
  */
 void TilesFramework::_send_player(bool force_full)
 {
+    send_timer timer(*this, TIME_SEND_PLAYER);
     player_info& c = m_current_player_info;
 
+    // Everything here changes along with the HUD, which is brought up to
+    // date at the start of every command and at -more- prompts; redraws in
+    // between (animations, menus, timed redraws) have nothing new to send.
+    if (!force_full && m_player_hud_generation == hud_generation())
+        return;
+    m_player_hud_generation = hud_generation();
+
+    _start_compact_message();
     json_open_object();
     json_write_string("msg", "player");
     json_treat_as_empty();
@@ -1042,6 +1628,16 @@ void TilesFramework::_send_player(bool force_full)
     json_open_object("inv");
     for (unsigned int i = 0; i < ENDOFPACK; ++i)
     {
+        // An empty slot that was empty before has nothing to send; don't
+        // bother building its item_info.
+        const item_def &item = you.inv[i];
+        if (!force_full && !item.defined()
+            && item.base_type == c.inv[i].base_type
+            && item.quantity == c.inv[i].quantity)
+        {
+            continue;
+        }
+
         json_open_object(to_string(i));
         _send_item(c.inv[i], get_item_info(you.inv[i]), force_full);
         json_close_object(true);
@@ -1263,8 +1859,10 @@ void TilesFramework::send_doll(const dolls_data &doll, bool submerged, bool ghos
             ymax = 18;
         }
 
-        tiles.json_write_comma();
-        tiles.write_message("[%u,%d]", (unsigned int) doll.parts[p], ymax);
+        tiles.json_open_array();
+        tiles.json_write_int(doll.parts[p]);
+        tiles.json_write_int(ymax);
+        tiles.json_close_array();
     }
     tiles.json_close_array();
 }
@@ -1282,8 +1880,8 @@ void TilesFramework::send_mcache(mcache_entry *entry, bool submerged, bool send)
             send_doll(*doll, submerged, trans);
         else
         {
-            tiles.json_write_comma();
-            tiles.write_message("\"doll\":[]");
+            tiles.json_open_array("doll");
+            tiles.json_close_array();
         }
     }
 
@@ -1293,9 +1891,11 @@ void TilesFramework::send_mcache(mcache_entry *entry, bool submerged, bool send)
     int draw_info_count = entry->info(&dinfo[0]);
     for (int i = 0; i < draw_info_count; i++)
     {
-        tiles.json_write_comma();
-        tiles.write_message("[%u,%d,%d]", (unsigned int) dinfo[i].idx,
-                            dinfo[i].ofs_x, dinfo[i].ofs_y);
+        tiles.json_open_array();
+        tiles.json_write_int(dinfo[i].idx);
+        tiles.json_write_int(dinfo[i].ofs_x);
+        tiles.json_write_int(dinfo[i].ofs_y);
+        tiles.json_close_array();
     }
 
     tiles.json_close_array();
@@ -1336,9 +1936,14 @@ void TilesFramework::write_tileidx(tileidx_t t)
     const int lo = t & 0xFFFFFFFF;
     const int hi = t >> 32;
     if (hi == 0)
-        tiles.write_message("%d", lo);
+        json_write_int(lo);
     else
-        tiles.write_message("[%d,%d]", lo, hi);
+    {
+        json_open_array();
+        json_write_int(lo);
+        json_write_int(hi);
+        json_close_array();
+    }
 }
 
 void TilesFramework::_send_cell(const coord_def &gc,
@@ -1494,8 +2099,12 @@ void TilesFramework::_send_cell(const coord_def &gc,
                     send_mcache(entry, in_water);
                 else
                 {
-                    json_write_comma();
-                    write_message("\"doll\":[[%d,%d]]", TILEP_MONS_UNKNOWN, TILE_Y);
+                    json_open_array("doll");
+                    json_open_array();
+                    json_write_int(TILEP_MONS_UNKNOWN);
+                    json_write_int(TILE_Y);
+                    json_close_array();
+                    json_close_array();
                     json_write_null("mcache");
                 }
             }
@@ -1544,8 +2153,12 @@ void TilesFramework::_send_cell(const coord_def &gc,
         {
             if (fg_changed)
             {
-                json_write_comma();
-                write_message("\"doll\":[[%u,%d]]", (unsigned int) fg_idx, TILE_Y);
+                json_open_array("doll");
+                json_open_array();
+                json_write_int(fg_idx);
+                json_write_int(TILE_Y);
+                json_close_array();
+                json_close_array();
                 json_write_null("mcache");
             }
         }
@@ -1604,22 +2217,23 @@ void TilesFramework::_mcache_ref(bool inc)
 {
     for (int y = 0; y < GYM; y++)
         for (int x = 0; x < GXM; x++)
-        {
-            coord_def gc(x, y);
+            _mcache_ref(coord_def(x, y), inc);
+}
 
-            int fg_idx = m_current_view(gc).tile.fg & TILE_FLAG_MASK;
-            if (fg_idx >= TILEP_MCACHE_START)
-            {
-                mcache_entry *entry = mcache.get(fg_idx);
-                if (entry)
-                {
-                    if (inc)
-                        entry->inc_ref();
-                    else
-                        entry->dec_ref();
-                }
-            }
+void TilesFramework::_mcache_ref(const coord_def &gc, bool inc)
+{
+    int fg_idx = m_current_view(gc).tile.fg & TILE_FLAG_MASK;
+    if (fg_idx >= TILEP_MCACHE_START)
+    {
+        mcache_entry *entry = mcache.get(fg_idx);
+        if (entry)
+        {
+            if (inc)
+                entry->inc_ref();
+            else
+                entry->dec_ref();
         }
+    }
 }
 
 void TilesFramework::_send_map(bool force_full)
@@ -1629,12 +2243,14 @@ void TilesFramework::_send_map(bool force_full)
         return;
 
     unwind_bool no_rentry(_send_lock, true);
+    send_timer timer(*this, TIME_SEND_MAP);
 
     map<uint32_t, coord_def> new_monster_locs;
 
     force_full = force_full || m_need_full_map;
     m_need_full_map = false;
 
+    _start_compact_message();
     json_open_object();
     json_write_string("msg", "map");
     json_treat_as_empty();
@@ -1667,6 +2283,7 @@ void TilesFramework::_send_map(bool force_full)
 
     coord_def last_gc(0, 0);
     bool send_gc = true;
+    vector<coord_def> sent_cells;
 
     json_open_array("cells");
     for (int y = 0; y < GYM; y++)
@@ -1687,6 +2304,7 @@ void TilesFramework::_send_map(bool force_full)
             }
 
             mark_clean(gc);
+            sent_cells.push_back(gc);
 
             if (m_origin.equals(-1, -1))
                 m_origin = gc;
@@ -1727,13 +2345,36 @@ void TilesFramework::_send_map(bool force_full)
     if (force_full)
         _send_cursor(CURSOR_MAP);
 
-    if (m_mcache_ref_done)
-        _mcache_ref(false);
+    // Only the cells we just sent can differ from what the client has, so
+    // only those need to be remembered; on a full redraw that is all of them.
+    if (force_full)
+    {
+        if (m_mcache_ref_done)
+            _mcache_ref(false);
+
+        m_current_map_knowledge = env.map_knowledge;
+        m_current_view = m_next_view;
 
-    m_current_map_knowledge = env.map_knowledge;
-    m_current_view = m_next_view;
+        _mcache_ref(true);
+    }
+    else
+    {
+        if (m_mcache_ref_done)
+            for (const coord_def &gc : sent_cells)
+                _mcache_ref(gc, false);
 
-    _mcache_ref(true);
+        for (const coord_def &gc : sent_cells)
+        {
+            m_current_map_knowledge(gc) = env.map_knowledge(gc);
+            m_current_view(gc) = m_next_view(gc);
+        }
+
+        if (m_mcache_ref_done)
+            for (const coord_def &gc : sent_cells)
+                _mcache_ref(gc, true);
+        else
+            _mcache_ref(true);
+    }
     m_mcache_ref_done = true;
 
     m_monster_locs = new_monster_locs;
@@ -1743,6 +2384,7 @@ void TilesFramework::_send_monster(const coord_def &gc, const monster_info* m,
                                    map<uint32_t, coord_def>& new_monster_locs,
                                    bool force_full)
 {
+    send_timer timer(*this, TIME_SEND_MONSTER);
     json_open_object("mon");
     if (m->client_id)
     {
@@ -1989,7 +2631,10 @@ void TilesFramework::cgotoxy(int x, int y, GotoRegion region)
     m_cursor_region = region;
 }
 
-void TilesFramework::redraw()
+// Map updates are sent at most tile_web_frame_rate times a second, and no
+// sooner than set_need_redraw() asked for; anything in between is coalesced
+// into the next update. force sends a pending update regardless.
+void TilesFramework::redraw(bool force)
 {
     if (!has_receivers())
     {
@@ -2026,6 +2671,10 @@ void TilesFramework::redraw()
 
     if (m_need_redraw && m_view_loaded)
     {
+        const unsigned int now = get_milliseconds();
+        if (!force && now - m_last_tick_redraw < m_redraw_delay)
+            return;
+
         if (m_current_flash_colour != m_next_flash_colour)
         {
             send_message("{\"msg\":\"flash\",\"col\":%d}",
@@ -2033,10 +2682,10 @@ void TilesFramework::redraw()
             m_current_flash_colour = m_next_flash_colour;
         }
         _send_map(false);
+        m_last_tick_redraw = now;
     }
 
     m_need_redraw = false;
-    m_last_tick_redraw = get_milliseconds();
 }
 
 void TilesFramework::update_minimap(const coord_def& gc)
@@ -2143,9 +2792,11 @@ void TilesFramework::clear_overlays()
 
 void TilesFramework::set_need_redraw(unsigned int min_tick_delay)
 {
-    unsigned int ticks = (get_milliseconds() - m_last_tick_redraw);
-    if (min_tick_delay && ticks <= min_tick_delay)
-        return;
+    const int rate = Options.tile_web_frame_rate;
+    const unsigned int delay = max(min_tick_delay,
+                                   rate > 0 ? 1000U / rate : 0U);
+    if (!m_need_redraw || delay < m_redraw_delay)
+        m_redraw_delay = delay;
 
     m_need_redraw = true;
 }
@@ -2239,41 +2890,66 @@ bool TilesFramework::cell_needs_redraw(const coord_def& gc)
     return m_cells_needing_redraw[gc.y * GXM + gc.x];
 }
 
-void TilesFramework::write_message_escaped(const string& s)
+void TilesFramework::write_message_escaped(json_text s)
 {
-    m_msg_buf.reserve(m_msg_buf.size() + s.size());
-
-    for (unsigned char c : s)
+    // Copy runs of characters that need no escaping in one go.
+    const char *run = s.str;
+    const char *end = s.str + s.len;
+    for (const char *p = s.str; p < end; ++p)
     {
+        const unsigned char c = *p;
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+
+        m_msg_buf.append(run, p - run);
+        run = p + 1;
         if (c == '"')
-            m_msg_buf.append("\\\"");
+            m_msg_buf.append("\\\"", 2);
         else if (c == '\\')
-            m_msg_buf.append("\\\\");
-        else if (c < 0x20)
+            m_msg_buf.append("\\\\", 2);
+        else
         {
-            char buf[7];
-            snprintf(buf, sizeof(buf), "\\u%04x", c);
-            m_msg_buf.append(buf);
+            static const char hex[] = "0123456789abcdef";
+            const char esc[] = { '\\', 'u', '0', '0', hex[c >> 4],
+                                 hex[c & 0xf] };
+            m_msg_buf.append(esc, sizeof(esc));
         }
-        else
-            m_msg_buf.append(1, c);
     }
+    m_msg_buf.append(run, end - run);
 }
 
-void TilesFramework::json_open(const string& name, char opener, char type)
+void TilesFramework::json_open(json_text name, char opener, char type)
 {
-    m_json_stack.resize(m_json_stack.size() + 1);
-    JsonFrame& fr = m_json_stack.back();
-    fr.start = m_msg_buf.size();
+    const int start = m_msg_buf.size();
+    int header = -1;
 
-    json_write_comma();
-    if (!name.empty())
-        json_write_name(name);
+    if (m_compact_msg)
+    {
+        // The member count isn't known yet, so leave room for a map16 or
+        // array16 header; json_close() fills it in, or shrinks it.
+        if (!name.empty())
+            json_write_name(name);
+        _compact_value();
+        header = m_msg_buf.size();
+        m_msg_buf.append(1, type == '}' ? '\xde' : '\xdc');
+        m_msg_buf.append(2, '\0');
+    }
+    else
+    {
+        json_write_comma();
+        if (!name.empty())
+            json_write_name(name);
 
-    m_msg_buf.append(1, opener);
+        m_msg_buf.append(1, opener);
+    }
 
+    m_json_stack.resize(m_json_stack.size() + 1);
+    JsonFrame& fr = m_json_stack.back();
+    fr.start = start;
     fr.prefix_end = m_msg_buf.size();
     fr.type = type;
+    fr.header = header;
+    fr.count = 0;
 }
 
 void TilesFramework::json_treat_as_empty()
@@ -2304,15 +2980,32 @@ void TilesFramework::json_close(bool erase_if_empty, char type)
     if (m_json_stack.back().type != type)
         die("json error: attempting to close wrong type");
 
-    if (erase_if_empty && json_is_empty())
-        m_msg_buf.resize(m_json_stack.back().start);
-    else
-        m_msg_buf.append(1, type);
-
+    const JsonFrame fr = m_json_stack.back();
     m_json_stack.pop_back();
+
+    if (erase_if_empty && fr.prefix_end == (int) m_msg_buf.size())
+    {
+        m_msg_buf.resize(fr.start);
+        if (m_compact_msg && !m_json_stack.empty())
+            m_json_stack.back().count--;
+    }
+    else if (!m_compact_msg)
+        m_msg_buf.append(1, type);
+    else if (fr.count < 16)
+    {
+        m_msg_buf[fr.header] = (type == '}' ? 0x80 : 0x90) | fr.count;
+        m_msg_buf.erase(fr.header + 1, 2);
+    }
+    else if (fr.count <= 0xffff)
+    {
+        m_msg_buf[fr.header + 1] = fr.count >> 8;
+        m_msg_buf[fr.header + 2] = fr.count & 0xff;
+    }
+    else
+        die("Webtiles message error: %d members in one container", fr.count);
 }
 
-void TilesFramework::json_open_object(const string& name)
+void TilesFramework::json_open_object(json_text name)
 {
     json_open(name, '{', '}');
 }
@@ -2322,7 +3015,7 @@ void TilesFramework::json_close_object(bool erase_if_empty)
     json_close(erase_if_empty, '}');
 }
 
-void TilesFramework::json_open_array(const string& name)
+void TilesFramework::json_open_array(json_text name)
 {
     json_open(name, '[', ']');
 }
@@ -2334,29 +3027,73 @@ void TilesFramework::json_close_array(bool erase_if_empty)
 
 void TilesFramework::json_write_comma()
 {
-    if (m_msg_buf.empty()) return;
+    if (m_compact_msg || m_msg_buf.empty()) return;
     char last = m_msg_buf[m_msg_buf.size() - 1];
     if (last == '{' || last == '[' || last == ',' || last == ':') return;
-    write_message(",");
+    m_msg_buf.push_back(',');
 }
 
-void TilesFramework::json_write_name(const string& name)
+void TilesFramework::json_write_name(json_text name)
 {
+    if (m_compact_msg)
+    {
+        _compact_value();
+        _compact_write_string(name);
+        m_compact_after_name = true;
+        return;
+    }
+
     json_write_comma();
 
-    write_message("\"");
+    m_msg_buf.push_back('"');
     write_message_escaped(name);
-    write_message("\":");
+    m_msg_buf.append("\":", 2);
 }
 
 void TilesFramework::json_write_int(int value)
 {
+    if (m_compact_msg)
+    {
+        _compact_value();
+        if (value >= 0)
+        {
+            if (value < 0x80)
+                m_msg_buf.append(1, (char) value);
+            else if (value <= 0xff)
+                _compact_write_uint('\xcc', value, 1);
+            else if (value <= 0xffff)
+                _compact_write_uint('\xcd', value, 2);
+            else
+                _compact_write_uint('\xce', value, 4);
+        }
+        else if (value >= -32)
+            m_msg_buf.append(1, (char) value);
+        else if (value >= -0x80)
+            _compact_write_uint('\xd0', value, 1);
+        else if (value >= -0x8000)
+            _compact_write_uint('\xd1', value, 2);
+        else
+            _compact_write_uint('\xd2', value, 4);
+        return;
+    }
+
     json_write_comma();
 
-    write_message("%d", value);
+    char buf[12];
+    char *p = buf + sizeof(buf);
+    unsigned int u = value < 0 ? 0u - (unsigned int) value : value;
+    do
+    {
+        *--p = '0' + u % 10;
+        u /= 10;
+    }
+    while (u);
+    if (value < 0)
+        *--p = '-';
+    m_msg_buf.append(p, buf + sizeof(buf) - p);
 }
 
-void TilesFramework::json_write_int(const string& name, int value)
+void TilesFramework::json_write_int(json_text name, int value)
 {
     if (!name.empty())
         json_write_name(name);
@@ -2366,15 +3103,22 @@ void TilesFramework::json_write_int(const string& name, int value)
 
 void TilesFramework::json_write_bool(bool value)
 {
+    if (m_compact_msg)
+    {
+        _compact_value();
+        m_msg_buf.append(1, value ? '\xc3' : '\xc2');
+        return;
+    }
+
     json_write_comma();
 
     if (value)
-        write_message("true");
+        m_msg_buf.append("true", 4);
     else
-        write_message("false");
+        m_msg_buf.append("false", 5);
 }
 
-void TilesFramework::json_write_bool(const string& name, bool value)
+void TilesFramework::json_write_bool(json_text name, bool value)
 {
     if (!name.empty())
         json_write_name(name);
@@ -2384,12 +3128,19 @@ void TilesFramework::json_write_bool(const string& name, bool value)
 
 void TilesFramework::json_write_null()
 {
+    if (m_compact_msg)
+    {
+        _compact_value();
+        m_msg_buf.append(1, '\xc0');
+        return;
+    }
+
     json_write_comma();
 
-    write_message("null");
+    m_msg_buf.append("null", 4);
 }
 
-void TilesFramework::json_write_null(const string& name)
+void TilesFramework::json_write_null(json_text name)
 {
     if (!name.empty())
         json_write_name(name);
@@ -2397,16 +3148,23 @@ void TilesFramework::json_write_null(const string& name)
     json_write_null();
 }
 
-void TilesFramework::json_write_string(const string& value)
+void TilesFramework::json_write_string(json_text value)
 {
+    if (m_compact_msg)
+    {
+        _compact_value();
+        _compact_write_string(value);
+        return;
+    }
+
     json_write_comma();
 
-    write_message("\"");
+    m_msg_buf.push_back('"');
     write_message_escaped(value);
-    write_message("\"");
+    m_msg_buf.push_back('"');
 }
 
-void TilesFramework::json_write_string(const string& name, const string& value)
+void TilesFramework::json_write_string(json_text name, json_text value)
 {
     if (!name.empty())
         json_write_name(name);
@@ -2414,6 +3172,256 @@ void TilesFramework::json_write_string(const string& name, const string& value)
     json_write_string(value);
 }
 
+// Write map and player messages compactly, if the servers all asked for it
+// and no other message is half-written.
+void TilesFramework::_start_compact_message()
+{
+    if (!m_msg_buf.empty() || m_dests.empty())
+        return;
+
+    for (const WebtilesDest &dest : m_dests)
+        if (!dest.compact)
+            return;
+
+    m_compact_msg = true;
+}
+
+// Count a new value (or object key) against the enclosing container; a
+// value that follows its key was already counted with the key.
+void TilesFramework::_compact_value()
+{
+    if (m_compact_after_name)
+        m_compact_after_name = false;
+    else if (!m_json_stack.empty())
+        m_json_stack.back().count++;
+}
+
+void TilesFramework::_compact_write_uint(uint8_t tag, uint32_t value,
+                                         int bytes)
+{
+    m_msg_buf.append(1, (char) tag);
+    for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8)
+        m_msg_buf.append(1, (char) ((value >> shift) & 0xff));
+}
+
+void TilesFramework::_compact_write_string(json_text value)
+{
+    const uint32_t len = value.len;
+    if (len < 32)
+        m_msg_buf.append(1, (char) (0xa0 | len));
+    else if (len <= 0xff)
+        _compact_write_uint(0xd9, len, 1);
+    else if (len <= 0xffff)
+        _compact_write_uint(0xda, len, 2);
+    else
+        _compact_write_uint(0xdb, len, 4);
+    m_msg_buf.append(value.str, value.len);
+}
+
+void TilesFramework::_write_json_node(const JsonNode *node, json_text name)
+{
+    switch (node->tag)
+    {
+    case JSON_NULL:
+        json_write_null(name);
+        break;
+    case JSON_BOOL:
+        json_write_bool(name, node->bool_);
+        break;
+    case JSON_STRING:
+        json_write_string(name, node->string_);
+        break;
+    case JSON_NUMBER:
+        json_write_int(name, (int) node->number_);
+        break;
+    case JSON_ARRAY:
+    case JSON_OBJECT:
+    {
+        const bool object = node->tag == JSON_OBJECT;
+        if (object)
+            json_open_object(name);
+        else
+            json_open_array(name);
+
+        const JsonNode *child;
+        json_foreach(child, node)
+            _write_json_node(child, object ? json_text(child->key)
+                                           : json_text());
+
+        if (object)
+            json_close_object();
+        else
+            json_close_array();
+        break;
+    }
+    }
+}
+
+/**
+ * Compare the JSON and compact encodings over a recorded session.
+ *
+ * @param filename  a file of webtiles messages, one JSON message per line,
+ *                  as crawl writes them to the server socket.
+ *
+ * Each message is re-encoded both ways from its parsed form, and the sizes
+ * (before and after compression for servers that negotiate deflate) and
+ * encoding times are printed per message type.
+ */
+void TilesFramework::compare_encodings(const string &filename)
+{
+    struct encoding_stats
+    {
+        int count;
+        size_t bytes[2];
+        size_t deflated[2];
+        chrono::steady_clock::duration time[2];
+    };
+    map<string, encoding_stats> stats;
+    const int reps = 20;
+
+    FILE *f = fopen_u(filename.c_str(), "r");
+    if (!f)
+        end(1, true, "Can't read %s", filename.c_str());
+
+    string line;
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), f))
+    {
+        line += buf;
+        if (line.empty() || line.back() != '\n' && !feof(f))
+            continue;
+
+        // Messages prefixed with '*' are sent even when spectating is
+        // paused; the prefix isn't part of the JSON.
+        const size_t json_start = line[0] == '*' ? 1 : 0;
+        JsonNode *node = json_decode(line.c_str() + json_start);
+        line.clear();
+        if (!node)
+            continue;
+
+        JsonNode *msg = json_find_member(node, "msg");
+        const string type = msg && msg->tag == JSON_STRING ? msg->string_
+                                                           : "(none)";
+        encoding_stats &st = stats[type];
+        st.count++;
+
+        for (int compact = 0; compact < 2; compact++)
+        {
+            const auto start = chrono::steady_clock::now();
+            for (int i = 0; i < reps; i++)
+            {
+                m_msg_buf.clear();
+                m_compact_msg = compact;
+                _write_json_node(node, "");
+            }
+            st.time[compact] += (chrono::steady_clock::now() - start) / reps;
+            _frame_message(compact);
+            st.bytes[compact] += m_msg_buf.size();
+            st.deflated[compact] += _deflate_message() ? m_deflate_buf.size()
+                                                       : m_msg_buf.size();
+        }
+        m_msg_buf.clear();
+        m_compact_msg = false;
+        json_delete(node);
+    }
+    fclose(f);
+
+    printf("%-24s %7s %12s %12s %6s %12s %12s %10s %10s\n", "message",
+           "count", "json bytes", "compact", "ratio", "json deflate",
+           "cmp deflate", "json us", "compact us");
+    auto print_row = [](const string &name, const encoding_stats &st)
+    {
+        printf("%-24s %7d %12zu %12zu %6.2f %12zu %12zu %10lld %10lld\n",
+               name.c_str(), st.count, st.bytes[0], st.bytes[1],
+               st.bytes[0] ? (double) st.bytes[1] / st.bytes[0] : 0.0,
+               st.deflated[0], st.deflated[1],
+               (long long) chrono::duration_cast<chrono::microseconds>(
+                   st.time[0]).count(),
+               (long long) chrono::duration_cast<chrono::microseconds>(
+                   st.time[1]).count());
+    };
+
+    encoding_stats total = {};
+    for (const auto &entry : stats)
+    {
+        const encoding_stats &st = entry.second;
+        print_row(entry.first, st);
+        total.count += st.count;
+        for (int i = 0; i < 2; i++)
+        {
+            total.bytes[i] += st.bytes[i];
+            total.deflated[i] += st.deflated[i];
+            total.time[i] += st.time[i];
+        }
+    }
+    print_row("total", total);
+}
+
+/**
+ * Encode, without sending, the full refresh a new spectator would get.
+ * Meant for benchmarks run from scripts: everything encoded is taken to have
+ * been sent, so this refuses to run with anyone attached.
+ *
+ * @return the number of bytes encoded.
+ */
+size_t TilesFramework::encode_everything()
+{
+    if (has_receivers())
+        return 0;
+
+    unwind_var<string> no_sock(m_sock_name, "");
+    const size_t start = m_encoded_bytes;
+    _send_everything();
+    return m_encoded_bytes - start;
+}
+
+/**
+ * Check that the full refresh _service_queues() gives a destination that
+ * fell behind leaves the other destinations in sync. Two local destinations
+ * stand in for servers; a view cell is changed without being sent, as it is
+ * while a map update waits for the frame rate, and then one of them is
+ * refreshed. For tests: this refuses to run with anyone attached.
+ *
+ * @return whether the other destination was sent the changed cell.
+ */
+bool TilesFramework::refresh_keeps_others_in_sync()
+{
+    if (has_receivers())
+        return false;
+
+    string kept, refreshed;
+    for (string *output : { &kept, &refreshed })
+    {
+        WebtilesDest dest;
+        dest.id = m_next_dest_id++;
+        dest.compact = false;
+        dest.deflate = false;
+        dest.local = true;
+        dest.output = output;
+        m_dests.push_back(dest);
+    }
+
+    // Start both off with everything.
+    load_dungeon(you.pos());
+    _send_everything();
+    flush_messages();
+    kept.clear();
+    refreshed.clear();
+
+    screen_cell_t &cell = m_next_view(you.pos());
+    cell.glyph = cell.glyph == '@' ? '&' : '@';
+    mark_dirty(you.pos());
+    set_need_redraw();
+
+    m_dests.back().needs_refresh = true;
+    _service_queues();
+    m_dests.clear();
+
+    static const string map_msg = "{\"msg\":\"map\"";
+    return kept.find(map_msg) != string::npos
+           && refreshed.find(map_msg) != string::npos;
+}
+
 bool is_tiles()
 {
     return tiles.is_controlled_from_web();
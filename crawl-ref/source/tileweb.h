@@ -8,7 +8,12 @@
 #ifdef USE_TILE_WEB
 
 #include <bitset>
+#include <chrono>
+#include <cstdarg>
+#include <cstring>
+#include <deque>
 #include <map>
+#include <memory>
 #include <sys/un.h>
 
 #include "cursor-type.h"
@@ -23,6 +28,37 @@
 #include "viewgeom.h"
 
 class Menu;
+struct JsonNode;
+
+// Map and player messages can be sent in a compact encoding instead of JSON,
+// if every attached server asked for this version of it with a "compact"
+// member in its attach message. The payload is the MessagePack form of the
+// JSON message that would otherwise have been sent; it is framed as a 0xFF
+// byte (which never starts a JSON message), the payload length as an
+// unsigned LEB128 varint, and the payload, with no trailing newline.
+#define WEBTILES_COMPACT_VERSION 1
+
+// Servers that ask for this version with a "deflate" member in their attach
+// message get large messages compressed. Each such message, JSON or compact,
+// is compressed on its own into a zlib stream that inflates to exactly the
+// bytes that would otherwise have been sent (trailing newline or compact
+// frame header included). It is framed as a 0xFE byte, the stream length as
+// an unsigned LEB128 varint, and the stream.
+#define WEBTILES_DEFLATE_VERSION 1
+
+// A borrowed string for the JSON writer, so that the literal names most
+// callers pass don't each need a std::string built and freed.
+struct json_text
+{
+    json_text() : str(""), len(0) { }
+    json_text(const char *s) : str(s), len(strlen(s)) { }
+    json_text(const string &s) : str(s.data()), len(s.size()) { }
+
+    bool empty() const { return len == 0; }
+
+    const char *str;
+    size_t len;
+};
 
 enum WebtilesUIState
 {
@@ -112,7 +148,7 @@ public:
     void mark_for_redraw(const coord_def& gc);
     void set_need_redraw(unsigned int min_tick_delay = 0);
     bool need_redraw() const;
-    void redraw();
+    void redraw(bool force = false);
 
     void place_cursor(cursor_type type, const coord_def &gc);
     void clear_text_tags(text_tag_type type);
@@ -154,7 +190,8 @@ public:
     void send_message(PRINTF(1, ));
     void flush_messages();
 
-    bool has_receivers() { return !m_dest_addrs.empty(); }
+    // A replay counts as a receiver, since it is there to measure output.
+    bool has_receivers() { return !m_dests.empty() || m_replay_file; }
     bool is_controlled_from_web() { return m_controlled_from_web; }
 
     /* Webtiles can receive input both via stdin, and on the
@@ -177,21 +214,21 @@ public:
     void check_for_control_messages();
 
     // Helper functions for writing JSON
-    void write_message_escaped(const string& s);
-    void json_open_object(const string& name = "");
+    void write_message_escaped(json_text s);
+    void json_open_object(json_text name = json_text());
     void json_close_object(bool erase_if_empty = false);
-    void json_open_array(const string& name = "");
+    void json_open_array(json_text name = json_text());
     void json_close_array(bool erase_if_empty = false);
     void json_write_comma();
-    void json_write_name(const string& name);
+    void json_write_name(json_text name);
     void json_write_int(int value);
-    void json_write_int(const string& name, int value);
+    void json_write_int(json_text name, int value);
     void json_write_bool(bool value);
-    void json_write_bool(const string& name, bool value);
+    void json_write_bool(json_text name, bool value);
     void json_write_null();
-    void json_write_null(const string& name);
-    void json_write_string(const string& value);
-    void json_write_string(const string& name, const string& value);
+    void json_write_null(json_text name);
+    void json_write_string(json_text value);
+    void json_write_string(json_text name, json_text value);
     /* Causes the current object/array to be erased if it is closed
        with erase_if_empty without writing any other content after
        this call */
@@ -201,6 +238,16 @@ public:
 
     string m_sock_name;
     bool m_await_connection;
+    // Control messages from the server are appended to m_record_name if it
+    // is set; if m_replay_name is set, they're read from there instead of
+    // the socket, and everything sent is written to m_output_name, if set.
+    // A replay sends as if to a server that asked for the compact encoding
+    // or deflate if m_replay_compact or m_replay_deflate is set.
+    string m_record_name;
+    string m_replay_name;
+    string m_output_name;
+    bool m_replay_compact;
+    bool m_replay_deflate;
 
     void set_text_cursor(bool enabled);
     void set_ui_state(WebtilesUIState state);
@@ -217,17 +264,97 @@ public:
 
     void send_doll(const dolls_data &doll, bool submerged, bool ghost);
 
+    void compare_encodings(const string &filename);
+    size_t encode_everything();
+    bool refresh_keeps_others_in_sync();
+    void print_replay_stats();
+
 protected:
     int m_sock;
     int m_max_msg_size;
+    // Reused for every message; it is only ever cleared, so it keeps its
+    // capacity.
     string m_msg_buf;
-    vector<sockaddr_un> m_dest_addrs;
+    size_t m_encoded_bytes;
+    // The compressed form of m_msg_buf, for destinations that asked for it.
+    string m_deflate_buf;
+
+    struct WebtilesDest
+    {
+        sockaddr_un addr;
+        int id;
+        bool compact;
+        bool deflate;
+        // Messages the socket wouldn't take yet, oldest first, and how much
+        // of the oldest has already gone out.
+        deque<shared_ptr<const string>> queue;
+        size_t queued_bytes = 0;
+        size_t sent = 0;
+        // Set when the queue overflowed and was dropped; the destination
+        // gets nothing more until it has had a full refresh.
+        bool needs_refresh = false;
+        // A local destination has no socket: what it's sent is appended to
+        // *output if that is set, and dropped otherwise. Replays and checks
+        // use them to stand in for servers.
+        bool local = false;
+        string *output = nullptr;
+    };
+    static const size_t MAX_QUEUED_BYTES = 1024 * 1024;
+    // Smaller messages aren't worth compressing.
+    static const size_t MIN_DEFLATE_BYTES = 2048;
+    vector<WebtilesDest> m_dests;
+    int m_next_dest_id;
+    // If not -1, messages go only to the destination with this id.
+    int m_only_dest;
+
+    // Whether the message in m_msg_buf is being written in the compact
+    // encoding, and whether the last thing written to it was an object key.
+    bool m_compact_msg;
+    bool m_compact_after_name;
 
     bool m_controlled_from_web;
     bool m_need_flush;
 
     bool _send_lock; // not thread safe
 
+    FILE *m_record_file;
+    uint64_t m_record_seed;
+    FILE *m_replay_file;
+    FILE *m_output_file;
+    int m_replayed;
+
+    // Gathered while replaying, for print_replay_stats().
+    struct message_stats
+    {
+        int count;
+        size_t bytes;  // framed
+        size_t sent;   // as sent to the replay's destination, if any
+    };
+    map<string, message_stats> m_message_stats;
+    enum send_timer_type
+    {
+        TIME_SEND_MAP,
+        TIME_SEND_PLAYER,
+        TIME_SEND_MONSTER,
+        NUM_SEND_TIMERS
+    };
+    chrono::steady_clock::duration m_send_time[NUM_SEND_TIMERS];
+    int m_send_calls[NUM_SEND_TIMERS];
+    friend class send_timer;
+
+    void _open_record_files();
+    void _record_control_message(const string &data);
+    bool _replay_input(wint_t &c, bool block);
+    message_stats &_count_message(bool compact);
+
+    void _frame_message(bool compact);
+    bool _deflate_message();
+    int _send_fragments(WebtilesDest &dest, const string &msg);
+    bool _send_queued(WebtilesDest &dest);
+    void _drop_queued(WebtilesDest &dest);
+    bool _have_queued() const;
+    void _service_queues();
+
     void _await_connection();
     wint_t _handle_control_message(sockaddr_un addr, string data);
     wint_t _receive_control_message();
@@ -237,12 +364,21 @@ protected:
         int start;
         int prefix_end;
         char type; // '}' or ']'
+        int header; // compact only: position of the size header
+        int count;  // compact only: members or elements written so far
     };
     vector<JsonFrame> m_json_stack;
 
-    void json_open(const string& name, char opener, char type);
+    void json_open(json_text name, char opener, char type);
     void json_close(bool erase_if_empty, char type);
 
+    void _start_compact_message();
+    void _compact_value();
+    void _compact_write_uint(uint8_t tag, uint32_t value, int bytes);
+    void _compact_write_string(json_text value);
+    void _write_json_node(const JsonNode *node, json_text name);
+    void _append_vformat(const char *format, va_list args);
+
     struct UIStackFrame
     {
         enum { MENU, CRT, UI, } type;
@@ -258,6 +394,8 @@ protected:
     vector<int> m_ui_cutoff_stack;
 
     unsigned int m_last_tick_redraw;
+    // How long after m_last_tick_redraw a pending map update may be sent.
+    unsigned int m_redraw_delay;
     bool m_need_redraw;
     bool m_layout_reset;
 
@@ -306,6 +444,9 @@ protected:
     dolls_data last_player_doll;
 
     player_info m_current_player_info;
+    // The hud_generation() m_current_player_info was last brought up to date
+    // for.
+    unsigned int m_player_hud_generation;
 
     void _send_version();
     void _send_options();
@@ -315,6 +456,7 @@ protected:
 
     bool m_mcache_ref_done;
     void _mcache_ref(bool inc);
+    void _mcache_ref(const coord_def &gc, bool inc);
 
     void _send_cursor(cursor_type type);
     void _send_map(bool force_full = false);
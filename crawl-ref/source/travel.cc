@@ -15,6 +15,7 @@
 #include <cstdarg>
 #include <cstdio>
 #include <memory>
+#include <queue>
 #include <set>
 #include <sstream>
 
@@ -2803,237 +2804,6 @@ static int _target_distance_from(const coord_def &pos)
     return -1;
 }
 
-/*
- * Sets best_stair to the coordinates of the best stair on the player's current
- * level to take to get to the 'target' level. Should be called with 'distance'
- * set to 0, 'stair' set to (you.x_pos, you.y_pos) and 'best_distance' set to
- * -1. 'cur' should be the player's current level.
- *
- * If best_stair remains unchanged when this function returns, there is no
- * travel-safe path between the player's current level and the target level OR
- * the player's current level *is* the target level.
- *
- * This function relies on the travel_point_distance array being correctly
- * populated with a floodout call to find_travel_pos starting from the player's
- * location.
- *
- * This function has undefined behavior when the target position is not
- * traversable.
- */
-static int _find_transtravel_stair(const level_id &cur,
-                                    const level_pos &target,
-                                    int distance,
-                                    // This is actually the current position
-                                    // on cur, not necessarily a stair.
-                                    const coord_def &stair,
-                                    level_id &closest_level,
-                                    int &best_level_distance,
-                                    coord_def &best_stair,
-                                    int search_depth = 0)
-{
-    int local_distance = -1;
-    level_id player_level = level_id::current();
-
-    LevelInfo &li = travel_cache.get_level_info(cur);
-
-    // Have we reached the target level?
-    if (cur == target.id)
-    {
-        // Are we in an exclude? If so, bail out. Unless it is just a stair exclusion.
-        if (is_excluded(stair, li.get_excludes()) && !is_stair_exclusion(stair))
-            return -1;
-
-        // If there's no target position on the target level, or we're on the
-        // target, we're home.
-        if (target.pos.x == -1 || target.pos == stair)
-            return distance;
-
-        // If there *is* a target position, we need to work out our distance
-        // from it.
-        int deltadist = _target_distance_from(stair);
-
-        if (deltadist == -1 && cur == player_level)
-        {
-            // Okay, we don't seem to have a distance available to us, which
-            // means we're either (a) not standing on stairs or (b) whoever
-            // initiated interlevel travel didn't call
-            // _populate_stair_distances. Assuming we're not on stairs, that
-            // situation can arise only if interlevel travel has been triggered
-            // for a location on the same level. If that's the case, we can get
-            // the distance off the travel_point_distance matrix.
-            deltadist = travel_point_distance[target.pos.x][target.pos.y];
-            if (!deltadist && stair != target.pos)
-                deltadist = -1;
-        }
-
-        if (deltadist != -1)
-        {
-            local_distance = distance + deltadist;
-
-            // See if this is a degenerate case of interlevel travel:
-            // A degenerate case of interlevel travel decays to normal travel;
-            // we identify this by checking if:
-            // a. The current level is the target level.
-            // b. The target square is reachable from the 'current' square.
-            // c. The current square is where the player is.
-            //
-            // Note that even if this *is* degenerate, interlevel travel may
-            // still be able to find a shorter route, since it can consider
-            // routes that leave and reenter the current level.
-            if (player_level == target.id && stair == you.pos())
-                best_stair = target.pos;
-
-            // The local_distance is already set, but there may actually be
-            // stairs we can take that'll get us to the target faster than the
-            // direct route, so we also try the stairs.
-        }
-    }
-
-    vector<stair_info> &stairs = li.get_stairs();
-
-    // this_stair being nullptr is perfectly acceptable, since we start with
-    // coords as the player coords, and the player need not be standing on
-    // stairs.
-    stair_info *this_stair = li.get_stair(stair);
-
-    if (!this_stair && cur != player_level)
-    {
-        // Whoops, there's no stair in the travel cache for the current
-        // position, and we're not on the player's current level (i.e., there
-        // certainly *should* be a stair here). Since we can't proceed in any
-        // reasonable way, bail out.
-        return local_distance;
-    }
-
-    for (stair_info &si : stairs)
-    {
-        if (stairs_destination_is_excluded(si))
-            continue;
-
-        // Skip placeholders and excluded stairs.
-        if (!si.can_travel() || is_excluded(si.position, li.get_excludes()))
-            continue;
-
-        int deltadist = li.distance_between(this_stair, &si);
-
-        if (!this_stair)
-        {
-            deltadist = travel_point_distance[si.position.x][si.position.y];
-            if (!deltadist && you.pos() != si.position)
-                deltadist = -1;
-        }
-        // deltadist == 0 is legal (if this_stair is nullptr), since the player
-        // may be standing on the stairs. If two stairs are disconnected,
-        // deltadist has to be negative.
-        if (deltadist < 0)
-            continue;
-
-        int dist2stair = distance + deltadist;
-        if (si.distance == -1 || si.distance > dist2stair)
-        {
-            si.distance = dist2stair;
-
-            // Account for the cost of taking the stairs
-            dist2stair += 500; // XXX: this seems large?
-
-            // Already too expensive? Short-circuit.
-            if (local_distance != -1 && dist2stair >= local_distance)
-                continue;
-
-            const level_pos &dest = si.destination;
-
-            // Never use escape hatches as the last leg of the trip, since
-            // that will leave the player unable to retrace their path.
-            // This does not apply if we have a destination with a specific
-            // position on the target level travel wants to get to.
-            if (feat_is_escape_hatch(si.grid)
-                && target.pos.x == -1
-                && dest.id == target.id)
-            {
-                continue;
-            }
-
-            // We can only short-circuit the stair-following process if we
-            // have no exact target location. If there *is* an exact target
-            // location, we can't follow stairs for which we have incomplete
-            // information.
-            if (target.pos.x == -1
-                && dest.id == target.id)
-            {
-                if (local_distance == -1 || local_distance > dist2stair)
-                {
-                    local_distance = dist2stair;
-                    if (cur == player_level && you.pos() == stair)
-                        best_stair = si.position;
-                }
-                continue;
-            }
-
-            if (dest.id.depth > -1) // We have a valid level descriptor.
-            {
-                int dist = level_distance(dest.id, target.id);
-                if (dist != -1 && (dist < best_level_distance
-                                   || best_level_distance == -1))
-                {
-                    best_level_distance = dist;
-                    closest_level       = dest.id;
-                }
-            }
-
-            // If we don't know where these stairs go, we can't take them.
-            if (!dest.is_valid())
-                continue;
-
-            // Don't try hell branches if we are not already in one or targeting
-            // one. When you actually enter the vestibule, the branch entry
-            // point is adjusted to be the portal you entered through, but
-            // autotravel needs to simulate this somehow, or it can find (fake)
-            // paths through hell that are shortcuts in depths, because the
-            // vestibule side of the portals do map to particular portals
-            // scattered throughout depths, even if those mappings won't be
-            // used while exiting from the vestibule.
-            if (is_hell_branch(dest.id.branch)
-                            && !(is_hell_branch(target.id.branch)
-                                 || is_hell_branch(cur.branch)))
-            {
-                continue;
-            }
-
-            // We need to get the stairs at the new location and set the
-            // distance on them as well.
-            LevelInfo &lo = travel_cache.get_level_info(dest.id);
-            if (stair_info *so = lo.get_stair(dest.pos))
-            {
-                if (so->distance == -1 || so->distance > dist2stair)
-                    so->distance = dist2stair;
-                else
-                    continue;   // We've already been here.
-            }
-#ifdef DEBUG_TRAVEL
-            string indent(search_depth, '.');
-            dprf("%strying stairs at %d,%d, dest is %d depth %d, pos %d,%d",
-                indent.c_str(), si.position.x, si.position.y, dest.id.branch,
-                dest.id.depth, dest.pos.x, dest.pos.y);
-#endif
-
-            // Okay, take these stairs and keep going.
-            const int newdist =
-                _find_transtravel_stair(dest.id, target,
-                                        dist2stair, dest.pos, closest_level,
-                                        best_level_distance, best_stair,
-                                        search_depth + 1);
-            if (newdist != -1
-                && (local_distance == -1 || local_distance > newdist))
-            {
-                local_distance = newdist;
-                if (cur == player_level && you.pos() == stair)
-                    best_stair = si.position;
-            }
-        }
-    }
-    return local_distance;
-}
-
 static bool _loadlev_populate_stair_distances(const level_pos &target)
 {
     level_excursion excursion;
@@ -3066,11 +2836,9 @@ static bool _find_transtravel_square(const level_pos &target, bool verbose)
     level_id current = level_id::current();
 
     coord_def best_stair(-1, -1);
-    coord_def cur_stair(you.pos());
 
     level_id closest_level;
     int best_level_distance = -1;
-    travel_cache.clear_distances();
 
     find_travel_pos(you.pos(), nullptr, nullptr, nullptr);
 
@@ -3083,13 +2851,12 @@ static bool _find_transtravel_square(const level_pos &target, bool verbose)
 
     if (maybe_traversable)
     {
-        _find_transtravel_stair(current, target,
-                                0, cur_stair, closest_level,
-                                best_level_distance, best_stair);
+        travel_cache.find_route(level_pos::current(), target, best_stair,
+                                closest_level, best_level_distance);
         dprf("found stair at %d,%d", best_stair.x, best_stair.y);
     }
-    // even without _find_transtravel_stair called, the values are initalized
-    // enough for the rest of this to go forward.
+    // even without find_route called, the values are initalized enough for
+    // the rest of this to go forward.
 
     if (best_stair.x != -1 && best_stair.y != -1)
     {
@@ -3417,11 +3184,32 @@ void LevelInfo::update_excludes()
     excludes = curr_excludes;
 }
 
+// Whether the travel cache's stair graph, which records where each stair is
+// and where it leads, would be the same for both stair lists.
+static bool _same_stair_nodes(const vector<stair_info> &a,
+                              const vector<stair_info> &b)
+{
+    if (a.size() != b.size())
+        return false;
+
+    for (int i = 0, size = a.size(); i < size; ++i)
+    {
+        if (a[i].position != b[i].position
+            || a[i].destination != b[i].destination)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
 void LevelInfo::update()
 {
     // First, set excludes, so that stair distances will be correctly populated.
     excludes = curr_excludes;
 
+    const vector<stair_info> old_stairs = stairs;
+
     // First, we get all known stairs.
     vector<coord_def> stair_positions;
     get_stairs(stair_positions);
@@ -3443,6 +3231,11 @@ void LevelInfo::update()
     correct_transporter_list(transporter_positions);
 
     update_daction_counters(this);
+
+    // Most updates find the same stairs as last time, so keep the graph.
+    // Stair distances needn't be compared: find_route reads them directly.
+    if (!_same_stair_nodes(old_stairs, stairs))
+        travel_cache.stairs_changed();
 }
 
 void LevelInfo::set_distance_between_stairs(int a, int b, int dist)
@@ -3528,6 +3321,8 @@ void LevelInfo::update_stair(const coord_def& stairpos, const level_pos &p,
     }
     else if (!si && guess)
         create_placeholder_stair(stairpos, p);
+
+    travel_cache.stairs_changed();
 }
 
 void LevelInfo::create_placeholder_stair(const coord_def &stair,
@@ -3591,6 +3386,8 @@ void LevelInfo::clear_stairs(dungeon_feature_type grid)
         si.destination.pos.y = -1;
         si.guessed_pos = true;
     }
+
+    travel_cache.stairs_changed();
 }
 
 bool LevelInfo::know_transporter(const coord_def &c) const
@@ -3807,12 +3604,6 @@ void LevelInfo::get_stairs(vector<coord_def> &st)
     }
 }
 
-void LevelInfo::clear_distances()
-{
-    for (stair_info &stair : stairs)
-        stair.clear_distance();
-}
-
 bool LevelInfo::is_known_branch(uint8_t branch) const
 {
     for (const stair_info &stair : stairs)
@@ -4176,10 +3967,302 @@ int TravelCache::get_waypoint_count() const
     return count;
 }
 
-void TravelCache::clear_distances()
+void TravelCache::update_stair_graph()
 {
+    stair_graph.clear();
+    stair_graph_levels.clear();
+
     for (auto &entry : levels)
-        entry.second.clear_distances();
+    {
+        // A level with no known stairs (after a shaft, say) has no nodes, so
+        // it mustn't have an entry pointing at the next level's.
+        LevelInfo &li = entry.second;
+        if (li.stairs.empty())
+            continue;
+
+        const int first = stair_graph.size();
+        stair_graph_levels[entry.first] = first;
+        for (int i = 0, size = li.stairs.size(); i < size; ++i)
+            stair_graph.push_back({ &li, i, first, -1 });
+    }
+
+    for (stair_node &node : stair_graph)
+    {
+        const level_pos &dest = node.level->stairs[node.stair].destination;
+        if (!dest.is_valid())
+            continue;
+
+        auto level = stair_graph_levels.find(dest.id);
+        if (level == stair_graph_levels.end())
+            continue;
+
+        const int index = levels[dest.id].get_stair_index(dest.pos);
+        if (index != -1)
+            node.dest = level->second + index;
+    }
+
+    stair_graph_valid = true;
+}
+
+// Whether travel may take this stair, or walk to it on the way elsewhere.
+static bool _stair_travelable(const stair_info &si, const LevelInfo &li)
+{
+    return !stairs_destination_is_excluded(si) && si.can_travel()
+           && !is_excluded(si.position, li.get_excludes());
+}
+
+// A Dijkstra search from the player's position: walking between stairs on a
+// level costs the travel distance between them, and taking a stair costs a
+// flat 500. Relies on travel_point_distance being populated from from.pos,
+// and on curr_stairs holding the distances to target.pos if there is one.
+int TravelCache::find_route(const level_pos &from, const level_pos &target,
+                            coord_def &first_stair, level_id &closest_level,
+                            int &best_level_distance)
+{
+    if (!stair_graph_valid)
+        update_stair_graph();
+
+    const level_id &current = from.id;
+    int best = -1;
+
+    auto found = [&](int distance, const coord_def &first)
+    {
+        if (best == -1 || distance < best)
+        {
+            best = distance;
+            first_stair = first;
+        }
+    };
+
+    // Can we get there without leaving the level?
+    if (current == target.id)
+    {
+        // Bail out if we're in an exclude, unless it is just a stair
+        // exclusion.
+        if (is_excluded(from.pos, get_level_info(current).get_excludes())
+            && !is_stair_exclusion(from.pos))
+        {
+            return -1;
+        }
+
+        // If there's no target position on the target level, or we're on the
+        // target, we're home.
+        if (target.pos.x == -1 || target.pos == from.pos)
+            return 0;
+
+        int deltadist = _target_distance_from(from.pos);
+        if (deltadist == -1)
+        {
+            deltadist = travel_point_distance[target.pos.x][target.pos.y];
+            if (!deltadist)
+                deltadist = -1;
+        }
+
+        // There may still be a faster route that leaves the level and comes
+        // back, so keep looking.
+        if (deltadist != -1)
+            found(deltadist, target.pos);
+    }
+
+    vector<int> dist(stair_graph.size(), -1);
+    // The stair on the player's level each node is reached through.
+    vector<coord_def> first(stair_graph.size());
+    typedef pair<int, int> queued; // distance, node
+    priority_queue<queued, vector<queued>, greater<queued>> queue;
+
+    auto reach = [&](int node, int distance, const coord_def &via)
+    {
+        if (dist[node] == -1 || distance < dist[node])
+        {
+            dist[node] = distance;
+            first[node] = via;
+            queue.emplace(distance, node);
+        }
+    };
+
+    auto here = stair_graph_levels.find(current);
+    if (here != stair_graph_levels.end())
+    {
+        const LevelInfo &li = *stair_graph[here->second].level;
+        for (int i = 0, size = li.stairs.size(); i < size; ++i)
+        {
+            const stair_info &si = li.stairs[i];
+            if (!_stair_travelable(si, li))
+                continue;
+
+            // 0 is legal only if the player is standing on the stairs.
+            const int deltadist =
+                travel_point_distance[si.position.x][si.position.y];
+            if (deltadist < 0 || !deltadist && from.pos != si.position)
+                continue;
+
+            reach(here->second + i, deltadist, si.position);
+        }
+    }
+
+    while (!queue.empty())
+    {
+        const int distance = queue.top().first;
+        const int node = queue.top().second;
+        queue.pop();
+
+        if (distance != dist[node])
+            continue;
+        if (best != -1 && distance >= best)
+            break;
+
+        const stair_node &sn = stair_graph[node];
+        const LevelInfo &li = *sn.level;
+        const stair_info &si = li.stairs[sn.stair];
+
+        if (li.id == target.id)
+        {
+            if (is_excluded(si.position, li.get_excludes())
+                && !is_stair_exclusion(si.position))
+            {
+                continue;
+            }
+
+            if (target.pos == si.position)
+            {
+                found(distance, first[node]);
+                continue;
+            }
+
+            const int deltadist = _target_distance_from(si.position);
+            if (deltadist != -1)
+                found(distance + deltadist, first[node]);
+        }
+
+        // Walk to another stair on this level...
+        const int nstairs = li.stairs.size();
+        for (int i = 0; i < nstairs; ++i)
+        {
+            if (i == sn.stair || !_stair_travelable(li.stairs[i], li))
+                continue;
+
+            // If two stairs are disconnected, their distance is negative.
+            const int deltadist = li.stair_distances[sn.stair * nstairs + i];
+            if (deltadist >= 0)
+                reach(sn.first + i, distance + deltadist, first[node]);
+        }
+
+        // ...or take this one.
+        if (!_stair_travelable(si, li))
+            continue;
+
+        // Account for the cost of taking the stairs
+        const int dist2stair = distance + 500; // XXX: this seems large?
+        const level_pos &dest = si.destination;
+
+        // We can only stop at the stairs if we have no exact target location.
+        // Never use escape hatches as the last leg of the trip, since that
+        // will leave the player unable to retrace their path.
+        if (target.pos.x == -1 && dest.id == target.id)
+        {
+            if (!feat_is_escape_hatch(si.grid))
+                found(dist2stair, first[node]);
+            continue;
+        }
+
+        if (dest.id.depth > -1) // We have a valid level descriptor.
+        {
+            int ldist = level_distance(dest.id, target.id);
+            if (ldist != -1 && (ldist < best_level_distance
+                                || best_level_distance == -1))
+            {
+                best_level_distance = ldist;
+                closest_level       = dest.id;
+            }
+        }
+
+        // If we don't know where these stairs go, we can't take them.
+        if (!dest.is_valid())
+            continue;
+
+        // Don't try hell branches if we are not already in one or targeting
+        // one. When you actually enter the vestibule, the branch entry
+        // point is adjusted to be the portal you entered through, but
+        // autotravel needs to simulate this somehow, or it can find (fake)
+        // paths through hell that are shortcuts in depths, because the
+        // vestibule side of the portals do map to particular portals
+        // scattered throughout depths, even if those mappings won't be
+        // used while exiting from the vestibule.
+        if (is_hell_branch(dest.id.branch)
+            && !(is_hell_branch(target.id.branch)
+                 || is_hell_branch(li.id.branch)))
+        {
+            continue;
+        }
+
+        if (sn.dest != -1)
+            reach(sn.dest, dist2stair, first[node]);
+        else if (dest == target)
+            found(dist2stair, first[node]);
+    }
+
+    return best;
+}
+
+int TravelCache::find_layout_route(const stair_layout &layout,
+                                   const level_pos &from,
+                                   const level_pos &target,
+                                   coord_def &first_stair)
+{
+    TravelCache cache;
+    for (const auto &entry : layout)
+    {
+        LevelInfo &li = cache.get_level_info(entry.first);
+        for (const auto &stair : entry.second)
+        {
+            stair_info si;
+            si.position = stair.first;
+            si.destination = stair.second;
+            si.grid = DNGN_STONE_STAIRS_DOWN_I;
+            si.guessed_pos = false;
+            li.stairs.push_back(si);
+        }
+
+        li.resize_stair_distances();
+        const int nstairs = li.stairs.size();
+        for (int i = 0; i < nstairs; ++i)
+            for (int j = 0; j < nstairs; ++j)
+            {
+                li.stair_distances[i * nstairs + j] =
+                    grid_distance(li.stairs[i].position,
+                                  li.stairs[j].position);
+            }
+    }
+
+    // find_route() reads travel_cache, travel_point_distance and
+    // curr_stairs; lend it the layout's versions of them.
+    static travel_distance_grid_t saved_distance;
+    memcpy(saved_distance, travel_point_distance, sizeof(saved_distance));
+    for (rectangle_iterator ri(0); ri; ++ri)
+        travel_point_distance[ri->x][ri->y] = grid_distance(from.pos, *ri);
+
+    vector<stair_info> saved_stairs;
+    saved_stairs.swap(curr_stairs);
+    if (target.pos.x != -1)
+    {
+        for (stair_info si : cache.get_level_info(target.id).get_stairs())
+        {
+            si.distance = grid_distance(si.position, target.pos);
+            curr_stairs.push_back(si);
+        }
+    }
+
+    swap(cache, travel_cache);
+    level_id closest_level;
+    int best_level_distance = -1;
+    const int distance = travel_cache.find_route(from, target, first_stair,
+                                                 closest_level,
+                                                 best_level_distance);
+    swap(cache, travel_cache);
+
+    curr_stairs.swap(saved_stairs);
+    memcpy(travel_point_distance, saved_distance, sizeof(saved_distance));
+    return distance;
 }
 
 bool TravelCache::is_known_branch(uint8_t branch) const
@@ -4237,6 +4320,7 @@ void TravelCache::load(reader& inf, int minorVersion)
         waypoints[wp].load(inf);
 
     fixup_levels();
+    stairs_changed();
 }
 
 void TravelCache::set_level_excludes()
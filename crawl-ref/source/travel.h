@@ -278,8 +278,6 @@ public:
     {
     }
 
-    void clear_distance() { distance = -1; }
-
     void save(writer&) const;
     void load(reader&);
 
@@ -345,7 +343,6 @@ struct LevelInfo
     int get_stair_index(const coord_def &pos) const;
     int get_transporter_index(const coord_def &pos) const;
 
-    void clear_distances();
     void set_level_excludes();
 
     const exclude_set &get_excludes() const
@@ -407,11 +404,16 @@ private:
 };
 
 const int TRAVEL_WAYPOINT_COUNT = 10;
+
+// The known stairs of each level, with where they lead (an invalid level_pos
+// if that isn't known).
+typedef map<level_id, vector<pair<coord_def, level_pos>>> stair_layout;
+
 // Tracks all levels that the player has seen.
 class TravelCache
 {
 public:
-    void clear_distances();
+    TravelCache() : stair_graph_valid(false) { }
 
     LevelInfo& get_level_info(const level_id &lev)
     {
@@ -429,6 +431,7 @@ public:
     void erase_level_info(const level_id& lev)
     {
         levels.erase(lev);
+        stairs_changed();
     }
 
     bool know_stair(const coord_def &c);
@@ -459,6 +462,25 @@ public:
     void update();
     void update_transporter(const coord_def &c);
 
+    // Called whenever a level's stairs or their destinations change. The
+    // distances between stairs are read from each level as routes are found.
+    void stairs_changed() { stair_graph_valid = false; }
+
+    // Finds the shortest known route from the player, at from, to target.
+    // Returns its length, or -1 if there is none, and sets first_stair to
+    // where on from's level to go first.
+    int find_route(const level_pos &from, const level_pos &target,
+                   coord_def &first_stair, level_id &closest_level,
+                   int &best_level_distance);
+
+    // Runs find_route() over a made-up layout of open levels, where walking
+    // between two squares costs their grid distance, in place of the travel
+    // cache. For tests.
+    static int find_layout_route(const stair_layout &layout,
+                                 const level_pos &from,
+                                 const level_pos &target,
+                                 coord_def &first_stair);
+
     void save(writer&) const;
     void load(reader&, int minorVersion);
 
@@ -472,11 +494,26 @@ public:
 private:
     void update_stone_stair(const coord_def &c);
     void fixup_levels();
+    void update_stair_graph();
 
 private:
     typedef map<level_id, LevelInfo> travel_levels_map;
     travel_levels_map levels;
     level_pos waypoints[TRAVEL_WAYPOINT_COUNT];
+
+    // Every known stair, as a node in the graph find_route() searches.
+    // Walking between stairs on a level costs what LevelInfo's
+    // stair_distances say; taking a stair leads to its destination's node.
+    struct stair_node
+    {
+        LevelInfo *level;
+        int stair;  // index into level->stairs
+        int first;  // node of level->stairs[0]
+        int dest;   // node the stair leads to, or -1 if not known
+    };
+    vector<stair_node> stair_graph;
+    map<level_id, int> stair_graph_levels; // level -> node of its first stair
+    bool stair_graph_valid;
 };
 
 // Handles travel and explore floodfill pathfinding. Does not do interlevel
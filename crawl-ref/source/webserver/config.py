@@ -149,6 +149,15 @@ max_idle_time = 5 * 60 * 60
 
 use_gzip = True
 
+# Ask crawl for its compact binary encoding of game messages. The server
+# turns every such message back into JSON for the browser, which costs far
+# more CPU than relaying JSON as it arrives, so only enable this if the
+# socket to crawl, rather than the server, is the bottleneck.
+crawl_compact_messages = False
+# Likewise, ask crawl to deflate large messages, which the server then has
+# to inflate again before relaying them.
+crawl_deflate_messages = False
+
 # Seconds until stale HTTP connections are closed
 # This needs a patch currently not in mainline tornado.
 http_connection_timeout = None
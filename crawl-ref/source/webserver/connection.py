@@ -3,12 +3,92 @@ import fcntl
 import os, os.path
 import time
 import warnings
+import zlib
 
 from datetime import datetime, timedelta
 from tornado.escape import json_encode
 
+import config
 from config import server_socket_path
 
+# Versions of the optional encodings we ask crawl for; see tileweb.h.
+COMPACT_VERSION = 1
+DEFLATE_VERSION = 1
+
+COMPACT_FRAME = "\xff"
+DEFLATE_FRAME = "\xfe"
+
+def _read_varint(data, pos):
+    """Reads an unsigned LEB128 varint. Returns (value, new pos), or
+    (None, pos) if data ends before the varint does."""
+    value = 0
+    shift = 0
+    while pos < len(data):
+        byte = ord(data[pos])
+        pos += 1
+        value |= (byte & 0x7f) << shift
+        if byte < 0x80:
+            return value, pos
+        shift += 7
+    return None, pos
+
+def _read_uint(data, pos, size):
+    value = 0
+    for i in xrange(size):
+        value = (value << 8) | ord(data[pos + i])
+    return value, pos + size
+
+def _read_int(data, pos, size):
+    value, pos = _read_uint(data, pos, size)
+    if value >= 1 << (size * 8 - 1):
+        value -= 1 << (size * 8)
+    return value, pos
+
+def _decode_compact(data, pos = 0):
+    """Decodes the MessagePack value at data[pos:]. Only the types crawl
+    writes in compact messages are supported. Returns (value, new pos)."""
+    tag = ord(data[pos])
+    pos += 1
+    if tag < 0x80:
+        return tag, pos
+    elif tag >= 0xe0:
+        return tag - 0x100, pos
+    elif tag < 0x90 or tag in (0xde, 0xdf):
+        if tag < 0x90:
+            count = tag & 0x0f
+        else:
+            count, pos = _read_uint(data, pos, 2 if tag == 0xde else 4)
+        obj = {}
+        for i in xrange(count):
+            key, pos = _decode_compact(data, pos)
+            obj[key], pos = _decode_compact(data, pos)
+        return obj, pos
+    elif tag < 0xa0 or tag in (0xdc, 0xdd):
+        if tag < 0xa0:
+            count = tag & 0x0f
+        else:
+            count, pos = _read_uint(data, pos, 2 if tag == 0xdc else 4)
+        array = []
+        for i in xrange(count):
+            value, pos = _decode_compact(data, pos)
+            array.append(value)
+        return array, pos
+    elif tag < 0xc0 or tag in (0xd9, 0xda, 0xdb):
+        if tag < 0xc0:
+            length = tag & 0x1f
+        else:
+            length, pos = _read_uint(data, pos, 1 << (tag - 0xd9))
+        return data[pos:pos + length].decode("utf-8", "replace"), pos + length
+    elif tag == 0xc0:
+        return None, pos
+    elif tag in (0xc2, 0xc3):
+        return tag == 0xc3, pos
+    elif 0xcc <= tag <= 0xcf:
+        return _read_uint(data, pos, 1 << (tag - 0xcc))
+    elif 0xd0 <= tag <= 0xd3:
+        return _read_int(data, pos, 1 << (tag - 0xd0))
+    raise ValueError("Unsupported MessagePack type 0x%02x" % tag)
+
 class WebtilesSocketConnection(object):
     def __init__(self, io_loop, socketpath, logger):
         self.io_loop = io_loop
@@ -59,10 +139,15 @@ class WebtilesSocketConnection(object):
                                  self._handle_read,
                                  self.io_loop.ERROR | self.io_loop.READ)
 
-        msg = json_encode({
-                "msg": "attach",
-                "primary": primary
-                })
+        attach = {
+            "msg": "attach",
+            "primary": primary
+            }
+        if getattr(config, "crawl_compact_messages", False):
+            attach["compact"] = COMPACT_VERSION
+        if getattr(config, "crawl_deflate_messages", False):
+            attach["deflate"] = DEFLATE_VERSION
+        msg = json_encode(attach)
 
         self.open = True
 
@@ -81,16 +166,42 @@ class WebtilesSocketConnection(object):
         if self.msg_buffer is not None:
             data = self.msg_buffer + data
 
-        if data[-1] != "\n":
-            # All messages from crawl end with \n.
-            # If this one doesn't, it's fragmented.
-            self.msg_buffer = data
-
-        else:
-            self.msg_buffer = None
-
-            if self.message_callback:
-                self.message_callback(data)
+        self.msg_buffer = self._split_messages(data)
+
+    def _split_messages(self, data):
+        """Passes every complete message in data on to message_callback, and
+        returns what's left of an incomplete one (or None)."""
+        # A read may end partway through a message, or (for small messages)
+        # hold more than one. JSON messages from crawl end with \n; compact
+        # and deflated messages are framed with their length instead.
+        pos = 0
+        while pos < len(data):
+            if data[pos] in (COMPACT_FRAME, DEFLATE_FRAME):
+                length, start = _read_varint(data, pos + 1)
+                if length is None or start + length > len(data):
+                    break
+                end = start + length
+            else:
+                end = data.find("\n", pos)
+                if end < 0:
+                    break
+                end += 1
+
+            if data[pos] == DEFLATE_FRAME:
+                # This inflates to exactly one JSON or compact message.
+                if self._split_messages(zlib.decompress(data[start:end])):
+                    self.logger.warning("Incomplete deflated message")
+            elif data[pos] == COMPACT_FRAME:
+                msg = json_encode(_decode_compact(data[start:end])[0]) + "\n"
+                if self.message_callback:
+                    self.message_callback(msg)
+            elif self.message_callback:
+                self.message_callback(data[pos:end])
+            pos = end
+
+        if pos < len(data):
+            return data[pos:]
+        return None
 
     def send_message(self, data):
         start = datetime.now()